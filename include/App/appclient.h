@@ -30,6 +30,19 @@
 /* types */
 typedef struct _AppClient AppClient;
 
+typedef struct _AppClientBatchCall
+{
+	char const * method;
+	Variable ** args;
+} AppClientBatchCall;
+
+/* res is the code of the call (0 on success), and negative on errors
+ * (-ETIMEDOUT without a reply in time, -ECANCELED if the client is deleted);
+ * result is the value returned if any, only valid within the callback;
+ * one-way calls complete as soon as they are queued */
+typedef void (*AppClientCallback)(AppClient * appclient, int res,
+		Variable * result, void * data);
+
 
 /* functions */
 AppClient * appclient_new(App * self, char const * app, char const * name);
@@ -40,11 +53,23 @@ void appclient_delete(AppClient * appclient);
 /* accessors */
 AppStatus * appclient_get_status(AppClient * appclient);
 
+/* the timeout is in milliseconds (0 to wait forever) */
+void appclient_set_timeout(AppClient * appclient, unsigned int timeout);
+
 /* useful */
 int appclient_call(AppClient * appclient,
 		void ** result, char const * method, ...);
 int appclient_callv(AppClient * appclient,
 		void ** result, char const * method, va_list args);
+int appclient_call_async(AppClient * appclient, AppClientCallback callback,
+		void * data, char const * method, ...);
+int appclient_call_asyncv(AppClient * appclient, AppClientCallback callback,
+		void * data, char const * method, va_list args);
+/* the calls of a batch are sent in a single message, and waited for until it
+ * is acknowledged (unless they are all one-way); their results and OUT
+ * arguments are not returned, use appclient_call_async() to obtain them */
+int appclient_call_batch(AppClient * appclient, AppClientBatchCall * calls,
+		size_t calls_cnt);
 int appclient_call_variable(AppClient * appclient,
 		Variable * result, char const * method, ...);
 int appclient_call_variables(AppClient * appclient,
@@ -52,4 +77,6 @@ int appclient_call_variables(AppClient * appclient,
 int appclient_call_variablev(AppClient * appclient,
 		Variable * result, char const * method, va_list args);
 
+int appclient_flush(AppClient * appclient);
+
 #endif /* !LIBAPP_APP_APPCLIENT_H */
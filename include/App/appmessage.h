@@ -18,6 +18,7 @@
 #ifndef LIBAPP_APP_APPMESSAGE_H
 # define LIBAPP_APP_APPMESSAGE_H
 
+# include <stdint.h>
 # include <System/buffer.h>
 # include <System/string.h>
 # include <System/variable.h>
@@ -32,11 +33,32 @@ typedef enum _AppMessageType
 	AMT_STATUS_GET = 0,
 	AMT_STATUS_SET,
 	AMT_CALL,
-	AMT_ACKNOWLEDGEMENT
+	AMT_ACKNOWLEDGEMENT,
+	AMT_HANDSHAKE,
+	AMT_BATCH,
+	AMT_REPLY
 } AppMessageType;
 # define AMT_CALLBACK	AMT_CALL
 
-typedef uint32_t AppMessageID;
+typedef uint64_t AppMessageID;
+
+/* frames */
+typedef struct _AppMessageFrame AppMessageFrame;
+
+/* pools */
+typedef struct _AppMessagePool AppMessagePool;
+
+typedef struct _AppMessagePoolStats
+{
+	/* messages obtained from the pool */
+	size_t hits;
+	/* messages allocated because the pool was empty */
+	size_t misses;
+	/* messages returned to the pool */
+	size_t recycled;
+	/* messages freed because the pool was full */
+	size_t discarded;
+} AppMessagePoolStats;
 
 /* calls */
 typedef enum _AppMessageCallDirection
@@ -59,7 +81,14 @@ typedef struct _AppMessageCallArgument
 
 
 /* functions */
+/* batches */
+AppMessage * appmessage_new_batch(void);
+/* deserialization */
 AppMessage * appmessage_new_deserialize(Buffer * buffer);
+AppMessage * appmessage_new_deserialize_frame(AppMessageFrame * frame,
+		size_t offset, size_t size);
+AppMessage * appmessage_new_deserialize_pool(AppMessagePool * pool,
+		AppMessageFrame * frame, size_t offset, size_t size);
 /* calls */
 AppMessage * appmessage_new_call(String const * method,
 		AppMessageCallArgument * args, size_t args_cnt);
@@ -71,10 +100,34 @@ AppMessage * appmessage_new_status(AppStatus * status);
 void appmessage_delete(AppMessage * appmessage);
 
 /* accessors */
+AppMessage * appmessage_get_batch_message(AppMessage * message, size_t index);
+size_t appmessage_get_batch_messages_count(AppMessage * message);
+
+Variable * appmessage_get_argument(AppMessage * message, size_t index);
+int appmessage_get_argument_data(AppMessage * message, size_t index,
+		VariableType * type, void const ** data, size_t * size);
+size_t appmessage_get_arguments_count(AppMessage * message);
 String const * appmessage_get_method(AppMessage * message);
 AppMessageType appmessage_get_type(AppMessage * message);
 
+/* pools (messages may be released from any thread) */
+AppMessagePool * appmessage_pool_new(size_t size);
+void appmessage_pool_delete(AppMessagePool * pool);
+
+void appmessage_pool_get_stats(AppMessagePool * pool,
+		AppMessagePoolStats * stats);
+
+/* frames (the references may be released from any thread) */
+AppMessageFrame * appmessage_frame_new(char * data, size_t size);
+AppMessageFrame * appmessage_frame_ref(AppMessageFrame * frame);
+void appmessage_frame_unref(AppMessageFrame * frame);
+
+char const * appmessage_frame_get_data(AppMessageFrame * frame);
+size_t appmessage_frame_get_size(AppMessageFrame * frame);
+
 /* useful */
+int appmessage_batch_append(AppMessage * message, AppMessage * call);
+
 int appmessage_serialize(AppMessage * message, Buffer * buffer);
 
 #endif /* !LIBAPP_APP_APPMESSAGE_H */
@@ -29,6 +29,12 @@ typedef void AppServerClient;
 
 typedef unsigned int AppServerOptions;
 # define ASO_REGISTER	0x1
+/* preserve the order of the calls of every client (with ASO_THREADS) */
+# define ASO_ORDERED	0x2
+/* serve the clients from additional threads (up to 255) */
+# define ASO_WORKERS(count)	(((count) & 0xff) << 8)
+/* handle the calls from a pool of threads (up to 255) */
+# define ASO_THREADS(count)	(((count) & 0xff) << 16)
 
 typedef struct _AppServer AppServer;
 
@@ -24,6 +24,8 @@
 
 /* AppTransport */
 /* types */
+struct addrinfo;
+
 typedef struct _AppTransport AppTransport;
 
 typedef struct _AppTransportClient AppTransportClient;
@@ -44,6 +46,9 @@ typedef enum _AppTransportStatus
 	ATS_ERROR_FATAL
 } AppTransportStatus;
 
+typedef unsigned int AppTransportFlags;
+# define ATF_SHARED	0x1
+
 typedef struct _AppTransportPlugin AppTransportPlugin;
 
 typedef struct _AppTransportPluginDefinition AppTransportPluginDefinition;
@@ -65,6 +70,19 @@ typedef struct _AppTransportPluginHelper
 			AppTransportClient * client);
 	int (*client_receive)(AppTransport * transport,
 			AppTransportClient * client, AppMessage * message);
+	void * (*client_get_data)(AppTransport * transport,
+			AppTransportClient * client);
+	void (*client_set_data)(AppTransport * transport,
+			AppTransportClient * client, void * data);
+
+	/* addresses */
+	int (*lookup)(AppTransport * transport, char const * hostname,
+			char const * servname, struct addrinfo const * hints,
+			struct addrinfo ** res);
+	void (*lookup_free)(AppTransport * transport, struct addrinfo * ai);
+
+	/* options */
+	AppTransportFlags flags;
 } AppTransportPluginHelper;
 
 struct _AppTransportPluginDefinition
@@ -82,6 +100,12 @@ struct _AppTransportPluginDefinition
 	/* ATM_SERVER */
 	int (*server_send)(AppTransportPlugin * transport,
 			AppTransportClient * client, AppMessage * message);
+	int (*server_get_client_name)(AppTransportPlugin * transport,
+			AppTransportClient * client, char * name, size_t size);
+
+	/* ATM_CLIENT (without waiting for the message to be sent) */
+	int (*client_queue)(AppTransportPlugin * transport,
+			AppMessage * message);
 };
 
 
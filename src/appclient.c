@@ -16,11 +16,14 @@
 
 
 #include <sys/types.h>
+#include <sys/time.h>
 #include <unistd.h>
+#include <stdint.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <errno.h>
 #include <System.h>
 #include "App/appclient.h"
@@ -31,7 +34,49 @@
 
 /* AppClient */
 /* private */
+/* constants */
+#ifndef APPCLIENT_PENDING_MAX
+# define APPCLIENT_PENDING_MAX	65536
+#endif
+#ifndef APPCLIENT_TIMEOUT
+# define APPCLIENT_TIMEOUT	30000
+#endif
+#define APPCLIENT_TICK		100
+#define APPCLIENT_WHEEL_SIZE	64
+/* deadline of the calls timed out, until completed */
+#define APPCLIENT_EXPIRED	UINT64_MAX
+
+
 /* types */
+typedef struct _AppClientWait
+{
+	int done;
+	int res;
+	AppMessage * reply;
+} AppClientWait;
+
+typedef struct _AppClientPending
+{
+	AppMessageID id;
+	AppClientCallback callback;
+	void * data;
+	/* synchronous calls obtain the whole reply instead */
+	AppClientWait * wait;
+
+	/* deadline (0 if none) */
+	uint64_t deadline;
+	struct _AppClientPending * prev;
+	struct _AppClientPending * next;
+} AppClientPending;
+
+/* timeouts (they may outlive their client, as the Event can be shared) */
+typedef struct _AppClientTimer
+{
+	AppClient * appclient;
+	/* calls being completed (the callbacks may re-enter the client) */
+	unsigned int busy;
+} AppClientTimer;
+
 struct _AppClient
 {
 	App * app;
@@ -40,6 +85,20 @@ struct _AppClient
 	int event_free;
 	AppTransport * transport;
 	AppTransportHelper helper;
+
+	/* asynchronous calls (indexed by ID) */
+	AppClientPending ** pending;
+	size_t pending_size;
+	size_t pending_cnt;
+	int flush;
+
+	/* deadlines (in ticks) */
+	unsigned int timeout;
+	AppClientPending * wheel[APPCLIENT_WHEEL_SIZE];
+	AppClientPending * wheel_expired;
+	size_t wheel_cnt;
+	uint64_t wheel_tick;
+	AppClientTimer * wheel_timer;
 };
 
 
@@ -48,6 +107,29 @@ struct _AppClient
 static int _appclient_helper_message(void * data, AppTransport * transport,
 		AppTransportClient * client, AppMessage * message);
 
+/* useful */
+static int _appclient_call_message(AppClient * appclient, AppMessage * message,
+		AppMessage ** reply);
+static void _appclient_complete(AppClient * appclient, AppMessageID id,
+		int res, AppMessage * reply);
+static void _appclient_complete_pending(AppClient * appclient,
+		AppClientPending * pending, int res, AppMessage * reply);
+static int _appclient_queue(AppClient * appclient, AppMessage * message,
+		AppClientCallback callback, void * data, AppClientWait * wait);
+
+static int _appclient_on_timeout(void * data);
+
+static int _appclient_pending_add(AppClient * appclient,
+		AppClientPending * pending);
+static AppClientPending * _appclient_pending_remove(AppClient * appclient,
+		AppMessageID id);
+
+static uint64_t _appclient_tick(void);
+static int _appclient_wheel_add(AppClient * appclient,
+		AppClientPending * pending);
+static void _appclient_wheel_remove(AppClient * appclient,
+		AppClientPending * pending);
+
 
 /* public */
 /* functions */
@@ -71,9 +153,21 @@ AppClient * appclient_new_event(App * self, char const * app,
 	if((appclient = object_new(sizeof(*appclient))) == NULL)
 		return NULL;
 	appclient->app = self;
+	appclient->pending = NULL;
+	appclient->pending_size = 0;
+	appclient->pending_cnt = 0;
+	appclient->flush = 0;
+	appclient->timeout = APPCLIENT_TIMEOUT;
+	memset(appclient->wheel, 0, sizeof(appclient->wheel));
+	appclient->wheel_expired = NULL;
+	appclient->wheel_cnt = 0;
+	appclient->wheel_tick = 0;
+	appclient->wheel_timer = NULL;
 	appclient->interface = appinterface_new(ATM_CLIENT, app);
 	appclient->helper.data = appclient;
 	appclient->helper.message = _appclient_helper_message;
+	appclient->helper.dispatch = NULL;
+	appclient->helper.flags = 0;
 	appclient->event = (event != NULL) ? event : event_new();
 	appclient->event_free = (event != NULL) ? 0 : 1;
 	appclient->transport = apptransport_new_app(ATM_CLIENT,
@@ -100,9 +194,31 @@ AppClient * appclient_new_event(App * self, char const * app,
 /* appclient_delete */
 void appclient_delete(AppClient * appclient)
 {
+	size_t i;
+	int res;
+
 #ifdef DEBUG
 	fprintf(stderr, "DEBUG: %s()\n", __func__);
 #endif
+	/* the calls still pending will never complete */
+	for(i = 0; i < appclient->pending_size && appclient->pending_cnt > 0;)
+		if(appclient->pending[i] != NULL)
+		{
+			res = error_set_code(-ECANCELED, "%s",
+					strerror(ECANCELED));
+			_appclient_complete(appclient,
+					appclient->pending[i]->id, res, NULL);
+		}
+		else
+			i++;
+	free(appclient->pending);
+	if(appclient->wheel_timer != NULL && appclient->event_free != 0
+			&& appclient->wheel_timer->busy == 0)
+		/* the timeout goes away with the Event */
+		object_delete(appclient->wheel_timer);
+	else if(appclient->wheel_timer != NULL)
+		/* let the timeout expire on its own */
+		appclient->wheel_timer->appclient = NULL;
 	if(appclient->interface != NULL)
 		appinterface_delete(appclient->interface);
 	if(appclient->event_free != 0)
@@ -126,6 +242,14 @@ AppStatus * appclient_get_status(AppClient * appclient)
 }
 
 
+/* appclient_set_timeout */
+void appclient_set_timeout(AppClient * appclient, unsigned int timeout)
+{
+	/* only affects the calls sent afterwards */
+	appclient->timeout = timeout;
+}
+
+
 /* useful */
 /* appclient_call */
 int appclient_call(AppClient * appclient,
@@ -144,6 +268,50 @@ int appclient_call(AppClient * appclient,
 /* appclient_callv */
 int appclient_callv(AppClient * appclient,
 		void ** result, char const * method, va_list ap)
+{
+	int ret;
+	va_list aq;
+	AppMessage * message;
+	AppMessage * reply;
+
+	/* the arguments are read again for the answer */
+	va_copy(aq, ap);
+	if((message = appinterface_messagev(appclient->interface, method, ap))
+			== NULL)
+	{
+		va_end(aq);
+		return -1;
+	}
+	ret = _appclient_call_message(appclient, message, &reply);
+	appmessage_delete(message);
+	/* obtain the answer (AICD_{,IN_}OUT) */
+	if(ret == 0 && reply != NULL)
+		ret = appinterface_replyv(appclient->interface, method, reply,
+				result, aq);
+	if(reply != NULL)
+		appmessage_delete(reply);
+	va_end(aq);
+	return ret;
+}
+
+
+/* appclient_call_async */
+int appclient_call_async(AppClient * appclient, AppClientCallback callback,
+		void * data, char const * method, ...)
+{
+	int ret;
+	va_list ap;
+
+	va_start(ap, method);
+	ret = appclient_call_asyncv(appclient, callback, data, method, ap);
+	va_end(ap);
+	return ret;
+}
+
+
+/* appclient_call_asyncv */
+int appclient_call_asyncv(AppClient * appclient, AppClientCallback callback,
+		void * data, char const * method, va_list ap)
 {
 	int ret;
 	AppMessage * message;
@@ -151,13 +319,60 @@ int appclient_callv(AppClient * appclient,
 	if((message = appinterface_messagev(appclient->interface, method, ap))
 			== NULL)
 		return -1;
-	/* FIXME obtain the answer (AICD_{,IN}OUT) */
-	ret = apptransport_client_send(appclient->transport, message, 1);
+	/* the message is only queued (the loop is not entered) */
+	if(appinterface_get_oneway(appclient->interface, message))
+	{
+		/* complete one-way calls right away */
+		if((ret = apptransport_client_queue(appclient->transport,
+						message, 0)) == 0
+				&& callback != NULL)
+			callback(appclient, 0, NULL, data);
+	}
+	else
+		ret = _appclient_queue(appclient, message, callback, data,
+				NULL);
 	appmessage_delete(message);
 	return ret;
 }
 
 
+/* appclient_call_batch */
+int appclient_call_batch(AppClient * appclient, AppClientBatchCall * calls,
+		size_t calls_cnt)
+{
+	int ret;
+	AppMessage * batch;
+	AppMessage * message;
+	size_t i;
+	int acknowledge = 0;
+
+	if((batch = appmessage_new_batch()) == NULL)
+		return -1;
+	/* send every call in a single message */
+	for(i = 0; i < calls_cnt; i++)
+	{
+		if((message = appinterface_message_variables(
+						appclient->interface,
+						calls[i].method, calls[i].args))
+				== NULL)
+			break;
+		/* batches of one-way calls are not acknowledged */
+		if(!appinterface_get_oneway(appclient->interface, message))
+			acknowledge = 1;
+		if(appmessage_batch_append(batch, message) != 0)
+		{
+			appmessage_delete(message);
+			break;
+		}
+	}
+	/* only the delivery of the batch is reported (see appclient.h) */
+	ret = (i == calls_cnt) ? apptransport_client_send(appclient->transport,
+			batch, acknowledge) : -1;
+	appmessage_delete(batch);
+	return ret;
+}
+
+
 /* appclient_call_variable */
 int appclient_call_variable(AppClient * appclient,
 		Variable * result, char const * method, ...)
@@ -178,13 +393,19 @@ int appclient_call_variables(AppClient * appclient,
 {
 	int ret;
 	AppMessage * message;
+	AppMessage * reply;
 
 	if((message = appinterface_message_variables(appclient->interface,
 					method, args)) == NULL)
 		return -1;
-	/* FIXME obtain the answer (AICD_{,IN}OUT) */
-	ret = apptransport_client_send(appclient->transport, message, 1);
+	ret = _appclient_call_message(appclient, message, &reply);
 	appmessage_delete(message);
+	/* obtain the answer (AICD_{,IN_}OUT) */
+	if(ret == 0 && reply != NULL)
+		ret = appinterface_reply_variables(appclient->interface,
+				method, reply, result, args);
+	if(reply != NULL)
+		appmessage_delete(reply);
 	return ret;
 }
 
@@ -194,22 +415,50 @@ int appclient_call_variablev(AppClient * appclient,
 		Variable * result, char const * method, va_list args)
 {
 	int ret;
-	AppMessage * message;
+	size_t cnt;
+	Variable ** argv;
+	size_t i;
 
-	if((message = appinterface_message_variablev(appclient->interface,
-					method, args)) == NULL)
+	/* the arguments may be updated by the answer */
+	if(appinterface_get_args_count(appclient->interface, &cnt, method)
+			!= 0)
 		return -1;
-	/* FIXME obtain the answer (AICD_{,IN}OUT) */
-	ret = apptransport_client_send(appclient->transport, message, 1);
-	appmessage_delete(message);
+	if(cnt == 0)
+		argv = NULL;
+	else if((argv = malloc(sizeof(*argv) * cnt)) == NULL)
+		return -error_set_code(-errno, "%s", strerror(errno));
+	for(i = 0; i < cnt; i++)
+		argv[i] = va_arg(args, Variable *);
+	ret = appclient_call_variables(appclient, result, method, argv);
+	free(argv);
+	return ret;
+}
+
+
+/* appclient_flush */
+int appclient_flush(AppClient * appclient)
+{
+	int ret;
+
+	if(appclient->pending_cnt == 0)
+		return 0;
+	/* wait for every asynchronous call to complete */
+	appclient->flush = 1;
+	ret = event_loop(appclient->event);
+	appclient->flush = 0;
+	if(ret == 0 && appclient->pending_cnt > 0)
+		return -error_set_code(1, "%s", "Some calls did not complete");
 	return ret;
 }
 
 
 /* private */
 /* appclient_helper_message */
+static void _helper_message_acks(AppClient * appclient, AppMessage * message);
 static int _helper_message_call(AppClient * appclient, AppTransport * transport,
 		AppMessage * message);
+static int _helper_message_handshake(AppClient * appclient,
+		AppMessage * message);
 
 static int _appclient_helper_message(void * data, AppTransport * transport,
 		AppTransportClient * client, AppMessage * message)
@@ -219,16 +468,80 @@ static int _appclient_helper_message(void * data, AppTransport * transport,
 	if(client != NULL)
 		/* XXX report error */
 		return -1;
+	/* the acknowledgements may be carried by any message */
+	_helper_message_acks(appclient, message);
 	switch(appmessage_get_type(message))
 	{
+		case AMT_ACKNOWLEDGEMENT:
+			/* may only carry acknowledgements */
+			if(appmessage_get_id(message) != 0)
+				_appclient_complete(appclient,
+						appmessage_get_id(message), 0,
+						NULL);
+			return 0;
+		case AMT_REPLY:
+			_appclient_complete(appclient,
+					appmessage_get_id(message),
+					appmessage_get_reply_code(message),
+					message);
+			return 0;
 		case AMT_CALL:
 			return _helper_message_call(appclient, transport,
 					message);
+		case AMT_HANDSHAKE:
+			return _helper_message_handshake(appclient, message);
 	}
 	/* FIXME implement */
 	return -1;
 }
 
+static void _helper_message_acks(AppClient * appclient, AppMessage * message)
+{
+	AppMessageID const * acks;
+	size_t cnt;
+	size_t i;
+	size_t j;
+	size_t size;
+	AppMessageID id;
+	AppClientPending * pending;
+
+	cnt = appmessage_get_acknowledgements(message, &acks);
+	for(i = 0; i < cnt; i++)
+	{
+		if(acks[i * 2] > acks[i * 2 + 1])
+			/* XXX report error */
+			continue;
+		/* look the IDs up unless the range is larger than the table */
+		if(acks[i * 2 + 1] - acks[i * 2] < appclient->pending_size)
+		{
+			for(id = acks[i * 2];; id++)
+			{
+				if(id != 0)
+					_appclient_complete(appclient, id, 0,
+							NULL);
+				if(id == acks[i * 2 + 1])
+					break;
+			}
+			continue;
+		}
+		for(j = 0; j < appclient->pending_size;)
+		{
+			if((pending = appclient->pending[j]) == NULL
+					|| pending->id < acks[i * 2]
+					|| pending->id > acks[i * 2 + 1])
+			{
+				j++;
+				continue;
+			}
+			/* the callback may have resized the table */
+			size = appclient->pending_size;
+			_appclient_complete(appclient, pending->id, 0, NULL);
+			if(appclient->pending_size != size)
+				j = 0;
+		}
+	}
+}
+
 static int _helper_message_call(AppClient * appclient, AppTransport * transport,
 		AppMessage * message)
 {
@@ -249,3 +562,360 @@ static int _helper_message_call(AppClient * appclient, AppTransport * transport,
 		variable_delete(result);
 	return ret;
 }
+
+static int _helper_message_handshake(AppClient * appclient,
+		AppMessage * message)
+{
+	/* the next calls will use the method IDs of the server */
+	return appinterface_set_handshake(appclient->interface, message);
+}
+
+
+/* useful */
+/* appclient_call_message */
+static int _appclient_call_message(AppClient * appclient, AppMessage * message,
+		AppMessage ** reply)
+{
+	AppClientWait wait = { 0, 0, NULL };
+	AppClientPending * pending;
+
+	*reply = NULL;
+	/* one-way calls are only sent (without an ID) */
+	if(appinterface_get_oneway(appclient->interface, message))
+		return apptransport_client_send(appclient->transport, message,
+				0);
+	if(_appclient_queue(appclient, message, NULL, NULL, &wait) != 0)
+		return -1;
+	/* wait for the reply (or an acknowledgement from older servers) */
+	while(wait.done == 0)
+		if(event_loop(appclient->event) != 0)
+			break;
+	if(wait.done == 0)
+	{
+		/* forget about the call */
+		if((pending = _appclient_pending_remove(appclient,
+						appmessage_get_id(message)))
+				!= NULL)
+		{
+			_appclient_wheel_remove(appclient, pending);
+			free(pending);
+		}
+		return -1;
+	}
+	*reply = wait.reply;
+	return wait.res;
+}
+
+
+/* appclient_complete */
+static void _appclient_complete(AppClient * appclient, AppMessageID id,
+		int res, AppMessage * reply)
+{
+	AppClientPending * pending;
+
+	if((pending = _appclient_pending_remove(appclient, id)) == NULL)
+		/* not an expected reply */
+		return;
+	_appclient_complete_pending(appclient, pending, res, reply);
+	if(appclient->pending_cnt == 0 && appclient->flush)
+		event_loop_quit(appclient->event);
+}
+
+
+/* appclient_complete_pending */
+static void _appclient_complete_pending(AppClient * appclient,
+		AppClientPending * pending, int res, AppMessage * reply)
+{
+	_appclient_wheel_remove(appclient, pending);
+	if(pending->wait != NULL)
+	{
+		/* keep the reply for the caller */
+		if(reply != NULL && (pending->wait->reply
+					= appmessage_new_move(reply)) == NULL)
+			res = -1;
+		pending->wait->res = res;
+		pending->wait->done = 1;
+		event_loop_quit(appclient->event);
+	}
+	else if(pending->callback != NULL)
+		pending->callback(appclient, res, (reply != NULL)
+				? appmessage_get_reply_result(reply) : NULL,
+				pending->data);
+	free(pending);
+}
+
+
+/* appclient_queue */
+static int _appclient_queue(AppClient * appclient, AppMessage * message,
+		AppClientCallback callback, void * data, AppClientWait * wait)
+{
+	AppClientPending * pending;
+
+	if(appclient->pending_cnt >= APPCLIENT_PENDING_MAX)
+		return -error_set_code(-EAGAIN, "%s", "Too many calls pending");
+	if((pending = malloc(sizeof(*pending))) == NULL)
+		return -error_set_code(-errno, "%s", strerror(errno));
+	/* the reply may come while queueing (or sending) */
+	apptransport_client_set_id(appclient->transport, message, 1);
+	pending->id = appmessage_get_id(message);
+	pending->callback = callback;
+	pending->data = data;
+	pending->wait = wait;
+	if(_appclient_pending_add(appclient, pending) != 0)
+	{
+		free(pending);
+		return -1;
+	}
+	if(_appclient_wheel_add(appclient, pending) != 0
+			|| apptransport_client_queue(appclient->transport,
+				message, 1) != 0)
+	{
+		/* the call may have completed already */
+		if(_appclient_pending_remove(appclient, pending->id) == NULL)
+			return -1;
+		_appclient_wheel_remove(appclient, pending);
+		free(pending);
+		return -1;
+	}
+	return 0;
+}
+
+
+/* appclient_on_timeout */
+static int _appclient_on_timeout(void * data)
+{
+	AppClientTimer * timer = data;
+	AppClient * appclient = timer->appclient;
+	uint64_t tick;
+	size_t i;
+	AppClientPending * pending;
+	AppClientPending * next;
+	int res;
+
+	/* the client may have been deleted in the meantime */
+	if(appclient == NULL)
+	{
+		/* unless still completing calls further up the stack */
+		if(timer->busy == 0)
+			object_delete(timer);
+		return 1;
+	}
+	tick = _appclient_tick();
+	/* visit the slots elapsed since the last tick (at most once each) */
+	for(i = 0; appclient->wheel_tick < tick && i < APPCLIENT_WHEEL_SIZE;
+			i++)
+	{
+		appclient->wheel_tick++;
+		for(pending = appclient->wheel[appclient->wheel_tick
+				% APPCLIENT_WHEEL_SIZE]; pending != NULL;
+				pending = next)
+		{
+			next = pending->next;
+			if(pending->deadline > tick)
+				/* expires on a later turn of the wheel */
+				continue;
+			/* set aside before running any callback */
+			_appclient_wheel_remove(appclient, pending);
+			pending->deadline = APPCLIENT_EXPIRED;
+			pending->prev = NULL;
+			if((pending->next = appclient->wheel_expired) != NULL)
+				pending->next->prev = pending;
+			appclient->wheel_expired = pending;
+			appclient->wheel_cnt++;
+		}
+	}
+	appclient->wheel_tick = tick;
+	/* the callbacks may complete, queue or delete anything */
+	timer->busy++;
+	while((pending = appclient->wheel_expired) != NULL)
+	{
+#ifdef DEBUG
+		fprintf(stderr, "DEBUG: %s() call %llu timed out\n", __func__,
+				(unsigned long long)pending->id);
+#endif
+		res = error_set_code(-ETIMEDOUT, "%s", strerror(ETIMEDOUT));
+		_appclient_pending_remove(appclient, pending->id);
+		_appclient_complete_pending(appclient, pending, res, NULL);
+		if(timer->appclient == NULL)
+			break;
+		if(appclient->pending_cnt == 0 && appclient->flush)
+			event_loop_quit(appclient->event);
+	}
+	timer->busy--;
+	if(timer->appclient == NULL)
+	{
+		/* the client was deleted by a callback */
+		if(timer->busy == 0)
+			object_delete(timer);
+		return 1;
+	}
+	if(appclient->wheel_cnt > 0 || timer->busy > 0)
+		return 0;
+	/* stop ticking once no call has a deadline */
+	appclient->wheel_timer = NULL;
+	object_delete(timer);
+	return 1;
+}
+
+
+/* appclient_pending_add */
+static int _pending_add_grow(AppClient * appclient);
+
+static int _appclient_pending_add(AppClient * appclient,
+		AppClientPending * pending)
+{
+	size_t mask;
+	size_t i;
+
+	/* keep the load factor under 1/2 */
+	if((appclient->pending_cnt + 1) * 2 > appclient->pending_size
+			&& _pending_add_grow(appclient) != 0)
+		return -1;
+	mask = appclient->pending_size - 1;
+	for(i = pending->id & mask; appclient->pending[i] != NULL;
+			i = (i + 1) & mask)
+		if(appclient->pending[i]->id == pending->id)
+			return -error_set_code(1, "%s", "Duplicate call ID");
+	appclient->pending[i] = pending;
+	appclient->pending_cnt++;
+	return 0;
+}
+
+static int _pending_add_grow(AppClient * appclient)
+{
+	AppClientPending ** p;
+	size_t size;
+	size_t mask;
+	size_t i;
+	size_t j;
+
+	size = (appclient->pending_size > 0) ? appclient->pending_size * 2 : 64;
+	if((p = calloc(size, sizeof(*p))) == NULL)
+		return -error_set_code(-errno, "%s", strerror(errno));
+	mask = size - 1;
+	for(i = 0; i < appclient->pending_size; i++)
+	{
+		if(appclient->pending[i] == NULL)
+			continue;
+		for(j = appclient->pending[i]->id & mask; p[j] != NULL;
+				j = (j + 1) & mask);
+		p[j] = appclient->pending[i];
+	}
+	free(appclient->pending);
+	appclient->pending = p;
+	appclient->pending_size = size;
+	return 0;
+}
+
+
+/* appclient_pending_remove */
+static AppClientPending * _appclient_pending_remove(AppClient * appclient,
+		AppMessageID id)
+{
+	AppClientPending * ret;
+	size_t mask;
+	size_t i;
+	size_t j;
+	size_t k;
+
+	if(appclient->pending_cnt == 0)
+		return NULL;
+	mask = appclient->pending_size - 1;
+	for(i = id & mask; (ret = appclient->pending[i]) != NULL;
+			i = (i + 1) & mask)
+		if(ret->id == id)
+			break;
+	if(ret == NULL)
+		return NULL;
+	/* shift the following entries back (no tombstones) */
+	for(j = (i + 1) & mask; appclient->pending[j] != NULL;
+			j = (j + 1) & mask)
+	{
+		k = appclient->pending[j]->id & mask;
+		/* move it unless its home slot lies within (i, j] */
+		if((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j)))
+		{
+			appclient->pending[i] = appclient->pending[j];
+			i = j;
+		}
+	}
+	appclient->pending[i] = NULL;
+	appclient->pending_cnt--;
+	return ret;
+}
+
+
+/* appclient_tick */
+static uint64_t _appclient_tick(void)
+{
+	struct timespec ts;
+
+	if(clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+		return 0;
+	return ((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000)
+		/ APPCLIENT_TICK;
+}
+
+
+/* appclient_wheel_add */
+static int _appclient_wheel_add(AppClient * appclient,
+		AppClientPending * pending)
+{
+	struct timeval tv = { 0, APPCLIENT_TICK * 1000 };
+	uint64_t tick;
+	AppClientTimer * timer;
+	AppClientPending ** slot;
+
+	pending->deadline = 0;
+	pending->prev = NULL;
+	pending->next = NULL;
+	if(appclient->timeout == 0)
+		/* this call never expires */
+		return 0;
+	tick = _appclient_tick();
+	if(appclient->wheel_timer == NULL)
+	{
+		/* start ticking */
+		if((timer = object_new(sizeof(*timer))) == NULL)
+			return -1;
+		timer->appclient = appclient;
+		timer->busy = 0;
+		if(event_register_timeout(appclient->event, &tv,
+					_appclient_on_timeout, timer) != 0)
+		{
+			object_delete(timer);
+			return -1;
+		}
+		appclient->wheel_timer = timer;
+		appclient->wheel_tick = tick;
+	}
+	/* round up to the next tick */
+	pending->deadline = tick + (appclient->timeout + APPCLIENT_TICK - 1)
+		/ APPCLIENT_TICK;
+	slot = &appclient->wheel[pending->deadline % APPCLIENT_WHEEL_SIZE];
+	if((pending->next = *slot) != NULL)
+		pending->next->prev = pending;
+	*slot = pending;
+	appclient->wheel_cnt++;
+	return 0;
+}
+
+
+/* appclient_wheel_remove */
+static void _appclient_wheel_remove(AppClient * appclient,
+		AppClientPending * pending)
+{
+	if(pending->deadline == 0)
+		return;
+	if(pending->prev != NULL)
+		pending->prev->next = pending->next;
+	else if(pending->deadline == APPCLIENT_EXPIRED)
+		appclient->wheel_expired = pending->next;
+	else
+		appclient->wheel[pending->deadline % APPCLIENT_WHEEL_SIZE]
+			= pending->next;
+	if(pending->next != NULL)
+		pending->next->prev = pending->prev;
+	pending->deadline = 0;
+	appclient->wheel_cnt--;
+}
@@ -23,12 +23,16 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
 #include <errno.h>
+#include <fnmatch.h>
 #include <System.h>
 #include <System/Marshall.h>
 #include "App/appmessage.h"
 #include "App/appserver.h"
+#include "appmessage.h"
 #include "appstatus.h"
+#include "apptransport.h"
 #include "appinterface.h"
 #include "../config.h"
 
@@ -71,6 +75,30 @@ typedef struct _AppInterfaceCallArg
 	size_t size;
 } AppInterfaceCallArg;
 
+/* storage for the AICD_{,IN_}OUT arguments while calling handlers */
+typedef struct _AppInterfaceCallValue
+{
+	union
+	{
+		bool b;
+		int8_t i8;
+		uint8_t u8;
+		int16_t i16;
+		uint16_t u16;
+		int32_t i32;
+		uint32_t u32;
+		int64_t i64;
+		uint64_t u64;
+		String * str;
+		Buffer * buf;
+		float f;
+		double d;
+	} u;
+	/* owned by the library */
+	String * str;
+	Buffer * buf;
+} AppInterfaceCallValue;
+
 typedef struct _AppInterfaceCall
 {
 	char * name;
@@ -78,6 +106,16 @@ typedef struct _AppInterfaceCall
 	AppInterfaceCallArg * args;
 	size_t args_cnt;
 	MarshallCall call;
+	/* as advertised by the server */
+	AppMessageMethodID id;
+	/* not replied to (fire-and-forget) */
+	int oneway;
+
+	/* access control (patterns of client names) */
+	String ** allow;
+	size_t allow_cnt;
+	String ** deny;
+	size_t deny_cnt;
 } AppInterfaceCall;
 
 struct _AppInterface
@@ -89,6 +127,9 @@ struct _AppInterface
 	AppStatus * status;
 	AppInterfaceCall * calls;
 	size_t calls_cnt;
+	/* open addressing on the names of the calls (index + 1) */
+	size_t * calls_index;
+	size_t calls_index_size;
 	AppInterfaceCall * callbacks;
 	size_t callbacks_cnt;
 	/* XXX for hash_foreach() in _new_interface_do() */
@@ -153,6 +194,20 @@ static const StringEnum _string_type[] =
 	{ "BUFFER_OUT",	VT_BUFFER	| AICD_OUT	},
 	{ "FLOAT_OUT",	VT_FLOAT	| AICD_OUT	},
 	{ "DOUBLE_OUT",	VT_DOUBLE	| AICD_OUT	},
+	/* input/output */
+	{ "BOOL_INOUT",	VT_BOOL		| AICD_IN_OUT	},
+	{ "INT8_INOUT",	VT_INT8		| AICD_IN_OUT	},
+	{ "UINT8_INOUT",	VT_UINT8	| AICD_IN_OUT	},
+	{ "INT16_INOUT",	VT_INT16	| AICD_IN_OUT	},
+	{ "UINT16_INOUT",	VT_UINT16	| AICD_IN_OUT	},
+	{ "INT32_INOUT",	VT_INT32	| AICD_IN_OUT	},
+	{ "UINT32_INOUT",	VT_UINT32	| AICD_IN_OUT	},
+	{ "INT64_INOUT",	VT_INT64	| AICD_IN_OUT	},
+	{ "UINT64_INOUT",	VT_UINT64	| AICD_IN_OUT	},
+	{ "STRING_INOUT",	VT_STRING	| AICD_IN_OUT	},
+	{ "BUFFER_INOUT",	VT_BUFFER	| AICD_IN_OUT	},
+	{ "FLOAT_INOUT",	VT_FLOAT	| AICD_IN_OUT	},
+	{ "DOUBLE_INOUT",	VT_DOUBLE	| AICD_IN_OUT	},
 	{ NULL,		0				}
 };
 
@@ -163,6 +218,11 @@ static int _string_enum(String const * string, StringEnum const * se);
 /* accessors */
 static AppInterfaceCall * _appinterface_get_call(AppInterface * appinterface,
 		char const * method);
+static AppInterfaceCall * _appinterface_get_call_message(
+		AppInterface * appinterface, AppMessage * message);
+static unsigned int _appinterface_hash(String const * string);
+static AppInterfaceCall * _appinterface_lookup_call(
+		AppInterface * appinterface, String const * method);
 
 /* useful */
 static Variable ** _appinterface_argv_new(AppInterfaceCall * call,
@@ -234,12 +294,17 @@ static AppInterfaceCall * _new_interface_append_call(AppInterface * ai,
 		VariableType type, char const * method);
 static AppInterfaceCall * _new_interface_append_callback(AppInterface * ai,
 		VariableType type, char const * method);
+static int _new_interface_append_acl(String *** patterns, size_t * cnt,
+		String const * list);
 static int _new_interface_append_arg(AppInterfaceCall * call, char const * arg);
 AppInterface * _new_interface_do(AppTransportMode mode, String const * app,
 		String const * pathname);
 static int _new_interface_do_appstatus(AppInterface * appinterface);
+static int _new_interface_do_index(AppInterface * appinterface);
 static int _new_interface_foreach_calls(char const * key, Hash * value,
 		AppInterface * appinterface);
+static int _new_interface_foreach_calls_oneway(AppInterfaceCall * call,
+		Hash * value, AppInterface * appinterface);
 static int _new_interface_foreach_callbacks(char const * key, Hash * value,
 		AppInterface * appinterface);
 static AppInterface * _new_interface_mode_client(AppTransportMode mode,
@@ -278,6 +343,12 @@ static AppInterfaceCall * _new_interface_append_call(AppInterface * ai,
 	p->type.direction = type & AICD_MASK;
 	p->args = NULL;
 	p->args_cnt = 0;
+	p->id = AMMI_NONE;
+	p->oneway = 0;
+	p->allow = NULL;
+	p->allow_cnt = 0;
+	p->deny = NULL;
+	p->deny_cnt = 0;
 	ai->calls_cnt++;
 	return p;
 }
@@ -301,10 +372,42 @@ static AppInterfaceCall * _new_interface_append_callback(AppInterface * ai,
 	p->type.direction = type & AICD_MASK;
 	p->args = NULL;
 	p->args_cnt = 0;
+	p->id = AMMI_NONE;
+	p->oneway = 0;
+	p->allow = NULL;
+	p->allow_cnt = 0;
+	p->deny = NULL;
+	p->deny_cnt = 0;
 	ai->callbacks_cnt++;
 	return p;
 }
 
+static int _new_interface_append_acl(String *** patterns, size_t * cnt,
+		String const * list)
+{
+	String const * p;
+	size_t len;
+	String ** q;
+
+	/* comma-separated list of patterns */
+	for(p = list; *p != '\0'; p += len)
+	{
+		for(; *p == ',' || isspace((unsigned char)*p); p++);
+		for(len = 0; p[len] != '\0' && p[len] != ','; len++);
+		while(len > 0 && isspace((unsigned char)p[len - 1]))
+			len--;
+		if(len == 0)
+			continue;
+		if((q = realloc(*patterns, sizeof(*q) * (*cnt + 1))) == NULL)
+			return error_set_code(-errno, "%s", strerror(errno));
+		*patterns = q;
+		if((q[*cnt] = string_new_length(p, len)) == NULL)
+			return -1;
+		(*cnt)++;
+	}
+	return 0;
+}
+
 static int _new_interface_append_arg(AppInterfaceCall * call, char const * arg)
 {
 	char buf[16];
@@ -348,6 +451,8 @@ AppInterface * _new_interface_do(AppTransportMode mode, String const * app,
 	appinterface->status = NULL;
 	appinterface->calls = NULL;
 	appinterface->calls_cnt = 0;
+	appinterface->calls_index = NULL;
+	appinterface->calls_index_size = 0;
 	appinterface->callbacks = NULL;
 	appinterface->callbacks_cnt = 0;
 	appinterface->error = 0;
@@ -366,7 +471,8 @@ AppInterface * _new_interface_do(AppTransportMode mode, String const * app,
 	hash_foreach(appinterface->config,
 			(HashForeach)_new_interface_foreach_callbacks,
 			appinterface);
-	if(appinterface->error != 0)
+	if(appinterface->error != 0
+			|| _new_interface_do_index(appinterface) != 0)
 	{
 		appinterface_delete(appinterface);
 		return NULL;
@@ -383,6 +489,32 @@ static int _new_interface_do_appstatus(AppInterface * appinterface)
 	return 0;
 }
 
+static int _new_interface_do_index(AppInterface * appinterface)
+{
+	size_t size;
+	size_t i;
+	size_t j;
+
+	/* keep the load factor under 50% */
+	for(size = 8; size < appinterface->calls_cnt * 2; size *= 2);
+	if((appinterface->calls_index = malloc(
+					sizeof(*appinterface->calls_index)
+					* size)) == NULL)
+		return -error_set_code(-errno, "%s", strerror(errno));
+	memset(appinterface->calls_index, 0,
+			sizeof(*appinterface->calls_index) * size);
+	appinterface->calls_index_size = size;
+	for(i = 0; i < appinterface->calls_cnt; i++)
+	{
+		for(j = _appinterface_hash(appinterface->calls[i].name)
+				& (size - 1);
+				appinterface->calls_index[j] != 0;
+				j = (j + 1) & (size - 1));
+		appinterface->calls_index[j] = i + 1;
+	}
+	return 0;
+}
+
 static int _new_interface_foreach_callbacks(char const * key, Hash * value,
 		AppInterface * appinterface)
 {
@@ -449,6 +581,17 @@ static int _new_interface_foreach_calls(char const * key, Hash * value,
 		appinterface->error = 1;
 		return -appinterface->error;
 	}
+	/* compile the access control rules */
+	if(((p = hash_get(value, "allow")) != NULL
+				&& _new_interface_append_acl(&call->allow,
+					&call->allow_cnt, p) != 0)
+			|| ((p = hash_get(value, "deny")) != NULL
+				&& _new_interface_append_acl(&call->deny,
+					&call->deny_cnt, p) != 0))
+	{
+		appinterface->error = 1;
+		return -appinterface->error;
+	}
 	for(i = 0; i < APPSERVER_MAX_ARGUMENTS; i++)
 	{
 		snprintf(buf, sizeof(buf), "arg%u", i + 1);
@@ -461,6 +604,34 @@ static int _new_interface_foreach_calls(char const * key, Hash * value,
 			return -1;
 		}
 	}
+	return _new_interface_foreach_calls_oneway(call, value, appinterface);
+}
+
+static int _new_interface_foreach_calls_oneway(AppInterfaceCall * call,
+		Hash * value, AppInterface * appinterface)
+{
+	char const * p;
+	size_t i;
+
+	if((p = hash_get(value, "oneway")) == NULL || strcmp(p, "0") == 0)
+		return 0;
+	if(strcmp(p, "1") != 0)
+	{
+		appinterface->error = error_set_code(1, "%s: %s", p,
+				"Invalid value for oneway");
+		return -appinterface->error;
+	}
+	/* nothing can be obtained without a reply */
+	for(i = 0; i < call->args_cnt; i++)
+		if(call->args[i].direction & AICD_OUT)
+			break;
+	if(call->type.type != VT_NULL || i != call->args_cnt)
+	{
+		appinterface->error = error_set_code(1, "%s: %s", call->name,
+				"One-way calls cannot return values");
+		return -appinterface->error;
+	}
+	call->oneway = 1;
 	return 0;
 }
 
@@ -543,6 +714,8 @@ AppInterface * _new_interface_mode_server(AppTransportMode mode,
 
 
 /* appinterface_delete */
+static void _delete_acl(String ** patterns, size_t cnt);
+
 void appinterface_delete(AppInterface * appinterface)
 {
 	size_t i;
@@ -553,14 +726,28 @@ void appinterface_delete(AppInterface * appinterface)
 	{
 		string_delete(appinterface->calls[i].name);
 		free(appinterface->calls[i].args);
+		_delete_acl(appinterface->calls[i].allow,
+				appinterface->calls[i].allow_cnt);
+		_delete_acl(appinterface->calls[i].deny,
+				appinterface->calls[i].deny_cnt);
 	}
 	free(appinterface->calls);
+	free(appinterface->calls_index);
 	if(appinterface->status != NULL)
 		appstatus_delete(appinterface->status);
 	string_delete(appinterface->name);
 	object_delete(appinterface);
 }
 
+static void _delete_acl(String ** patterns, size_t cnt)
+{
+	size_t i;
+
+	for(i = 0; i < cnt; i++)
+		string_delete(patterns[i]);
+	free(patterns);
+}
+
 
 /* accessors */
 /* appinterface_can_call */
@@ -569,6 +756,9 @@ static int _can_call_client(AppInterface * appinterface,
 static int _can_call_server(AppInterface * appinterface,
 		AppInterfaceCall * call, char const * name);
 
+static int _can_call_do(AppInterface * appinterface, AppInterfaceCall * call,
+		char const * name);
+
 int appinterface_can_call(AppInterface * appinterface, char const * method,
 		char const * name)
 {
@@ -576,6 +766,12 @@ int appinterface_can_call(AppInterface * appinterface, char const * method,
 
 	if((call = _appinterface_get_call(appinterface, method)) == NULL)
 		return -1;
+	return _can_call_do(appinterface, call, name);
+}
+
+static int _can_call_do(AppInterface * appinterface, AppInterfaceCall * call,
+		char const * name)
+{
 	switch(appinterface->mode)
 	{
 		case ATM_CLIENT:
@@ -593,27 +789,59 @@ static int _can_call_client(AppInterface * appinterface,
 	return 1;
 }
 
+static int _can_call_server_match(String ** patterns, size_t cnt,
+		char const * name);
+
 static int _can_call_server(AppInterface * appinterface,
 		AppInterfaceCall * call, char const * name)
 {
-	int ret = 0;
-	String * section;
-	String const * allow;
-	String const * deny;
+	/* the deny rules take precedence */
+	if(_can_call_server_match(call->deny, call->deny_cnt, name))
+		return 0;
+	if(call->allow_cnt == 0)
+		return 1;
+	return _can_call_server_match(call->allow, call->allow_cnt, name);
+}
+
+static int _can_call_server_match(String ** patterns, size_t cnt,
+		char const * name)
+{
+	size_t i;
+
+	/* anonymous clients do not match any pattern */
+	if(name == NULL)
+		return 0;
+	for(i = 0; i < cnt; i++)
+		if(fnmatch(patterns[i], name, 0) == 0)
+			return 1;
+	return 0;
+}
+
 
-	if((section = string_new_append(APPINTERFACE_CALL_PREFIX, call->name,
-					NULL)) == NULL)
+/* appinterface_can_call_message */
+int appinterface_can_call_message(AppInterface * appinterface,
+		AppMessage * message, AppTransportClient * client)
+{
+	int ret;
+	AppInterfaceCall * call;
+	size_t index;
+	String const * name;
+
+	if((call = _appinterface_get_call_message(appinterface, message))
+			== NULL)
 		return -1;
-	allow = config_get(appinterface->config, section, "allow");
-	deny = config_get(appinterface->config, section, "deny");
-	/* FIXME implement pattern matching */
-	if(allow == NULL && deny == NULL)
-		ret = 1;
-	else if(deny != NULL)
-		ret = (strcmp(deny, name) == 0) ? 0 : 1;
-	else
-		ret = (strcmp(allow, name) == 0) ? 1 : 0;
-	string_delete(section);
+	if(client == NULL)
+		return _can_call_do(appinterface, call, NULL);
+	/* the verdict is cached for the lifetime of the client */
+	index = call - appinterface->calls;
+	if((ret = apptransport_client_get_verdict(client, index)) >= 0)
+		return ret;
+	/* only resolve the name of the client if there are rules */
+	name = (call->allow_cnt > 0 || call->deny_cnt > 0)
+		? apptransport_client_get_name(client) : NULL;
+	if((ret = _can_call_do(appinterface, call, name)) >= 0)
+		/* XXX we can ignore errors */
+		apptransport_client_set_verdict(client, index, ret);
 	return ret;
 }
 
@@ -638,6 +866,18 @@ int appinterface_get_args_count(AppInterface * appinterface, size_t * count,
 }
 
 
+/* appinterface_get_oneway */
+int appinterface_get_oneway(AppInterface * appinterface, AppMessage * message)
+{
+	AppInterfaceCall * call;
+
+	if((call = _appinterface_get_call_message(appinterface, message))
+			== NULL)
+		return 0;
+	return call->oneway;
+}
+
+
 /* appinterface_get_status */
 AppStatus * appinterface_get_status(AppInterface * appinterface)
 {
@@ -645,6 +885,35 @@ AppStatus * appinterface_get_status(AppInterface * appinterface)
 }
 
 
+/* appinterface_set_handshake */
+int appinterface_set_handshake(AppInterface * appinterface,
+		AppMessage * message)
+{
+	size_t i;
+	size_t j;
+	size_t cnt;
+	String const * method;
+	AppInterfaceCall * call;
+
+	if(appmessage_get_type(message) != AMT_HANDSHAKE)
+		return -error_set_code(1, "%s", "Not a handshake");
+	for(i = 0; i < appinterface->calls_cnt; i++)
+		appinterface->calls[i].id = AMMI_NONE;
+	/* the calls unknown to the server keep using their name */
+	cnt = appmessage_get_handshake_methods_count(message);
+	for(j = 0; j < cnt; j++)
+	{
+		if((method = appmessage_get_handshake_method(message, j))
+				== NULL)
+			return -1;
+		if((call = _appinterface_lookup_call(appinterface, method))
+				!= NULL)
+			call->id = j;
+	}
+	return 0;
+}
+
+
 /* useful */
 /* appinterface_callv */
 int appinterface_callv(AppInterface * appinterface, App * app,
@@ -698,6 +967,127 @@ int appinterface_call_variablev(AppInterface * appinterface, App * app,
 }
 
 
+/* appinterface_call_message */
+static void _call_message_free(AppInterfaceCall * call, Variable ** argv,
+		size_t argc);
+static int _call_message_view(AppInterfaceCallArg * arg);
+static Variable * _call_message_view_new(AppInterfaceCall * call,
+		AppMessage * message, size_t i, size_t j);
+
+int appinterface_call_message(AppInterface * appinterface, App * app,
+		AppServerClient * asc, AppMessage * message, AppMessage ** reply)
+{
+	AppInterfaceCall * call;
+	Variable * buf[APPSERVER_MAX_ARGUMENTS];
+	Variable ** argv;
+	Variable * outv[APPSERVER_MAX_ARGUMENTS];
+	size_t outc = 0;
+	Variable * result = NULL;
+	size_t i;
+	size_t j;
+	int ret;
+
+	if(reply != NULL)
+		*reply = NULL;
+	if((call = _appinterface_get_call_message(appinterface, message))
+			== NULL)
+		return -1;
+	if(call->args_cnt <= sizeof(buf) / sizeof(*buf))
+		argv = buf;
+	else if((argv = object_new(sizeof(*argv) * call->args_cnt)) == NULL)
+		return -1;
+	/* the arguments remain owned by the message, except AICD_OUT */
+	for(i = 0, j = 0; i < call->args_cnt; i++)
+	{
+		if(call->args[i].direction == AICD_OUT)
+			argv[i] = variable_new(call->args[i].type, NULL);
+		else if(_call_message_view(&call->args[i]))
+			argv[i] = _call_message_view_new(call, message, i, j++);
+		else if((argv[i] = appmessage_get_argument(message, j++))
+				!= NULL
+				/* the handler trusts the types declared */
+				&& variable_get_type(argv[i])
+				!= call->args[i].type)
+		{
+			error_set_code(1, "%s: %s%zu", call->name,
+					"Invalid type for argument ", i + 1);
+			break;
+		}
+		if(argv[i] == NULL)
+			break;
+	}
+	if(i != call->args_cnt || j != appmessage_get_arguments_count(message))
+	{
+		if(i == call->args_cnt)
+			error_set_code(1, "%s: %s", call->name,
+					"Invalid number of arguments");
+		_call_message_free(call, argv, i);
+		return -1;
+	}
+	if(call->type.type != VT_NULL
+			&& (result = variable_new(call->type.type, NULL)) == NULL)
+	{
+		_call_message_free(call, argv, call->args_cnt);
+		return -1;
+	}
+	ret = _appinterface_call(app, asc, result, call, call->args_cnt, argv);
+	/* reply with the result and the AICD_{,IN_}OUT arguments */
+	if(reply != NULL && appmessage_get_id(message) != 0)
+	{
+		for(i = 0; i < call->args_cnt
+				&& outc < sizeof(outv) / sizeof(*outv); i++)
+			if(call->args[i].direction & AICD_OUT)
+				outv[outc++] = argv[i];
+		*reply = appmessage_new_reply(appmessage_get_id(message), ret,
+				(ret == 0) ? result : NULL, outv, outc);
+	}
+	if(result != NULL)
+		variable_delete(result);
+	_call_message_free(call, argv, call->args_cnt);
+	return ret;
+}
+
+static void _call_message_free(AppInterfaceCall * call, Variable ** argv,
+		size_t argc)
+{
+	size_t i;
+
+	for(i = 0; i < argc; i++)
+		if(call->args[i].direction == AICD_OUT
+				|| _call_message_view(&call->args[i]))
+			variable_delete(argv[i]);
+	if(call->args_cnt > APPSERVER_MAX_ARGUMENTS)
+		object_delete(argv);
+}
+
+static int _call_message_view(AppInterfaceCallArg * arg)
+{
+	/* the handlers only read these strings */
+	return (arg->direction == AICD_IN && arg->type == VT_STRING) ? 1 : 0;
+}
+
+static Variable * _call_message_view_new(AppInterfaceCall * call,
+		AppMessage * message, size_t i, size_t j)
+{
+	int res;
+	VariableType type;
+	void const * data;
+	size_t size;
+
+	res = appmessage_get_argument_data(message, j, &type, &data, &size);
+	if(res != 0 && j >= appmessage_get_arguments_count(message))
+		return NULL;
+	if(res != 0 || type != VT_STRING)
+	{
+		error_set_code(1, "%s: %s%zu", call->name,
+				"Invalid type for argument ", i + 1);
+		return NULL;
+	}
+	/* pass the string straight from the message (NUL-terminated) */
+	return variable_new(VT_POINTER, data);
+}
+
+
 /* appinterface_messagev */
 AppMessage * appinterface_messagev(AppInterface * appinterface,
 		char const * method, va_list ap)
@@ -716,6 +1106,30 @@ AppMessage * appinterface_messagev(AppInterface * appinterface,
 }
 
 
+/* appinterface_message_handshake */
+AppMessage * appinterface_message_handshake(AppInterface * appinterface)
+{
+	AppMessage * message;
+	String const ** methods;
+	size_t i;
+
+	if(appinterface->calls_cnt == 0)
+		methods = NULL;
+	else if((methods = malloc(sizeof(*methods) * appinterface->calls_cnt))
+			== NULL)
+	{
+		error_set_code(-errno, "%s", strerror(errno));
+		return NULL;
+	}
+	/* the method IDs are the indexes of the calls */
+	for(i = 0; i < appinterface->calls_cnt; i++)
+		methods[i] = appinterface->calls[i].name;
+	message = appmessage_new_handshake(methods, appinterface->calls_cnt);
+	free(methods);
+	return message;
+}
+
+
 /* appinterface_message_variables */
 AppMessage * appinterface_message_variables(AppInterface * appinterface,
 		char const * method, Variable ** args)
@@ -752,23 +1166,171 @@ AppMessage * appinterface_message_variablev(AppInterface * appinterface,
 }
 
 
+/* appinterface_reply_variables */
+int appinterface_reply_variables(AppInterface * appinterface,
+		char const * method, AppMessage * reply, Variable * result,
+		Variable ** args)
+{
+	AppInterfaceCall * call;
+	Variable * v;
+	size_t i;
+	size_t j;
+
+	if((call = _appinterface_get_call(appinterface, method)) == NULL)
+		return -1;
+	if(result != NULL && (v = appmessage_get_reply_result(reply)) != NULL
+			&& variable_set(result, v) != 0)
+		return -1;
+	for(i = 0, j = 0; i < call->args_cnt; i++)
+	{
+		if((call->args[i].direction & AICD_OUT) == 0)
+			continue;
+		if((v = appmessage_get_argument(reply, j++)) == NULL
+				|| variable_set(args[i], v) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+
+/* appinterface_replyv */
+static int _replyv_set(VariableType type, Variable * v, void * p);
+
+int appinterface_replyv(AppInterface * appinterface, char const * method,
+		AppMessage * reply, void * result, va_list ap)
+{
+	AppInterfaceCall * call;
+	Variable * v;
+	size_t i;
+	size_t j;
+	void * p;
+
+	if((call = _appinterface_get_call(appinterface, method)) == NULL)
+		return -1;
+	if(result != NULL && (v = appmessage_get_reply_result(reply)) != NULL
+			&& variable_get_as(v, call->type.type, result, NULL)
+			!= 0)
+		return -1;
+	/* the arguments are consumed as in appinterface_messagev() */
+	for(i = 0, j = 0; i < call->args_cnt; i++)
+	{
+		if(call->args[i].direction == AICD_IN)
+		{
+			if((v = variable_newv(call->args[i].type, ap)) != NULL)
+				variable_delete(v);
+			continue;
+		}
+		p = va_arg(ap, void *);
+		if((v = appmessage_get_argument(reply, j++)) == NULL
+				|| _replyv_set(call->args[i].type, v, p) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+static int _replyv_set(VariableType type, Variable * v, void * p)
+{
+	Buffer * buffer;
+	int ret;
+
+	if(p == NULL)
+		return 0;
+	if(type != VT_BUFFER)
+		return variable_get_as(v, type, p, NULL);
+	/* the contents of buffers are copied into the caller's */
+	if(variable_get_as(v, type, &buffer, NULL) != 0)
+		return -1;
+	ret = buffer_set(p, buffer_get_size(buffer), buffer_get_data(buffer));
+	buffer_delete(buffer);
+	return ret;
+}
+
+
 /* private */
 /* accessors */
 /* appinterface_get_call */
 static AppInterfaceCall * _appinterface_get_call(AppInterface * appinterface,
 		String const * method)
 {
-	size_t i;
+	AppInterfaceCall * call;
 
-	for(i = 0; i < appinterface->calls_cnt; i++)
-		if(string_compare(appinterface->calls[i].name, method) == 0)
-			return &appinterface->calls[i];
+	if((call = _appinterface_lookup_call(appinterface, method)) != NULL)
+		return call;
 	error_set_code(1, "%s%s%s%s", "Unknown call \"", method,
 			"\" for interface ", appinterface->name);
 	return NULL;
 }
 
 
+/* appinterface_get_call_message */
+static AppInterfaceCall * _appinterface_get_call_message(
+		AppInterface * appinterface, AppMessage * message)
+{
+	AppInterfaceCall * call;
+	AppMessageMethodID id;
+	String const * method;
+
+	/* the message may have been resolved already */
+	if((call = appmessage_get_interface_call(message)) != NULL
+			&& call >= appinterface->calls
+			&& call < &appinterface->calls[appinterface->calls_cnt])
+		return call;
+	/* the method IDs are the indexes of the calls */
+	if(appmessage_get_method_id(message, &id) == 0)
+	{
+		if(id >= appinterface->calls_cnt)
+		{
+			error_set_code(1, "%s%u%s%s", "Unknown method ID ", id,
+					" for interface ", appinterface->name);
+			return NULL;
+		}
+		call = &appinterface->calls[id];
+	}
+	else if((method = appmessage_get_method(message)) == NULL)
+	{
+		error_set_code(1, "%s", "Not a call");
+		return NULL;
+	}
+	else if((call = _appinterface_get_call(appinterface, method)) == NULL)
+		return NULL;
+	appmessage_set_interface_call(message, call);
+	return call;
+}
+
+
+/* appinterface_hash */
+static unsigned int _appinterface_hash(String const * string)
+{
+	unsigned int ret = 2166136261u;
+	unsigned char const * p;
+
+	/* FNV-1a */
+	for(p = (unsigned char const *)string; *p != '\0'; p++)
+		ret = (ret ^ *p) * 16777619u;
+	return ret;
+}
+
+
+/* appinterface_lookup_call */
+static AppInterfaceCall * _appinterface_lookup_call(
+		AppInterface * appinterface, String const * method)
+{
+	size_t mask = appinterface->calls_index_size - 1;
+	size_t i;
+	size_t j;
+
+	if(method == NULL || appinterface->calls_index_size == 0)
+		return NULL;
+	for(i = _appinterface_hash(method) & mask;
+			(j = appinterface->calls_index[i]) != 0;
+			i = (i + 1) & mask)
+		if(string_compare(appinterface->calls[j - 1].name, method)
+				== 0)
+			return &appinterface->calls[j - 1];
+	return NULL;
+}
+
+
 /* useful */
 /* appinterface_argv */
 static Variable * _argv_new_in(VariableType type, va_list ap);
@@ -985,13 +1547,20 @@ static void _appinterface_argv_free(Variable ** argv, size_t argc)
 
 
 /* appinterface_call */
+static Variable * _call_out_new(AppInterfaceCallArg * arg, Variable * v,
+		AppInterfaceCallValue * value);
+static int _call_out_set(AppInterfaceCallArg * arg, Variable * v,
+		AppInterfaceCallValue * value);
+
 static int _appinterface_call(App * app, AppServerClient * asc,
 		Variable * result, AppInterfaceCall * call,
 		size_t argc, Variable ** argv)
 {
 	int ret;
 	Variable ** p;
+	AppInterfaceCallValue * values = NULL;
 	size_t i;
+	size_t j;
 
 	if(argc != call->args_cnt)
 		/* XXX set the error */
@@ -1010,20 +1579,143 @@ static int _appinterface_call(App * app, AppServerClient * asc,
 		return -1;
 	}
 	for(i = 0; i < argc; i++)
-		p[i + 2] = argv[i];
-	ret = marshall_callp(result, call->call, argc + 2, p);
+		if((call->args[i].direction & AICD_OUT) == 0)
+			p[i + 2] = argv[i];
+		else if(values == NULL && (values = object_new(sizeof(*values)
+						* argc)) == NULL)
+			break;
+		/* the handlers obtain pointers to the values */
+		else if((p[i + 2] = _call_out_new(&call->args[i], argv[i],
+						&values[i])) == NULL)
+			break;
+	ret = (i == argc) ? marshall_callp(result, call->call, argc + 2, p)
+		: -1;
+	for(j = 0; j < i; j++)
+		if(call->args[j].direction & AICD_OUT)
+		{
+			if(_call_out_set(&call->args[j], argv[j], &values[j])
+					!= 0 && ret == 0)
+				ret = -1;
+			variable_delete(p[j + 2]);
+		}
+	if(values != NULL)
+		object_delete(values);
 	variable_delete(p[1]);
 	variable_delete(p[0]);
 	object_delete(p);
 	return ret;
 }
 
+static Variable * _call_out_new(AppInterfaceCallArg * arg, Variable * v,
+		AppInterfaceCallValue * value)
+{
+	Variable * w;
+
+	memset(value, 0, sizeof(*value));
+	if(arg->direction == AICD_IN_OUT
+			&& variable_get_as(v, arg->type, &value->u, NULL) != 0)
+		return NULL;
+	switch(arg->type)
+	{
+		case VT_STRING:
+			/* the handler may point to a string of its own */
+			value->str = value->u.str;
+			break;
+		case VT_BUFFER:
+			/* the handler fills the buffer in place */
+			if(value->u.buf == NULL && (value->u.buf = buffer_new(0,
+							NULL)) == NULL)
+				return NULL;
+			value->buf = value->u.buf;
+			break;
+		default:
+			break;
+	}
+	if((w = variable_new(VT_POINTER, (arg->type == VT_BUFFER)
+					? (void *)value->buf : (void *)&value->u))
+			!= NULL)
+		return w;
+	if(value->str != NULL)
+		string_delete(value->str);
+	if(value->buf != NULL)
+		buffer_delete(value->buf);
+	return NULL;
+}
+
+static int _call_out_set(AppInterfaceCallArg * arg, Variable * v,
+		AppInterfaceCallValue * value)
+{
+	Variable * w;
+
+	switch(arg->type)
+	{
+		case VT_BOOL:
+			w = variable_new(arg->type, value->u.b);
+			break;
+		case VT_INT8:
+			w = variable_new(arg->type, value->u.i8);
+			break;
+		case VT_UINT8:
+			w = variable_new(arg->type, value->u.u8);
+			break;
+		case VT_INT16:
+			w = variable_new(arg->type, value->u.i16);
+			break;
+		case VT_UINT16:
+			w = variable_new(arg->type, value->u.u16);
+			break;
+		case VT_INT32:
+			w = variable_new(arg->type, value->u.i32);
+			break;
+		case VT_UINT32:
+			w = variable_new(arg->type, value->u.u32);
+			break;
+		case VT_INT64:
+			w = variable_new(arg->type, value->u.i64);
+			break;
+		case VT_UINT64:
+			w = variable_new(arg->type, value->u.u64);
+			break;
+		case VT_FLOAT:
+			w = variable_new(arg->type, value->u.f);
+			break;
+		case VT_DOUBLE:
+			w = variable_new(arg->type, value->u.d);
+			break;
+		case VT_STRING:
+			/* the handler has to set it */
+			w = (value->u.str != NULL)
+				? variable_new(arg->type, value->u.str) : NULL;
+			break;
+		case VT_BUFFER:
+			w = variable_new(arg->type, value->buf);
+			break;
+		default:
+			w = NULL;
+			break;
+	}
+	if(value->str != NULL)
+		string_delete(value->str);
+	if(value->buf != NULL)
+		buffer_delete(value->buf);
+	if(w == NULL)
+		return -1;
+	if(variable_set(v, w) != 0)
+	{
+		variable_delete(w);
+		return -1;
+	}
+	variable_delete(w);
+	return 0;
+}
+
 
 /* appinterface_message */
 static AppMessage * _appinterface_message(AppInterfaceCall * call,
 		size_t argc, Variable ** argv)
 {
 	AppMessage * message;
+	AppMessageCallArgument buf[APPSERVER_MAX_ARGUMENTS];
 	AppMessageCallArgument * args;
 	size_t i;
 
@@ -1034,17 +1726,35 @@ static AppMessage * _appinterface_message(AppInterfaceCall * call,
 				", expected: ", call->args_cnt, ")");
 		return NULL;
 	}
-	if(argc == 0)
-		args = NULL;
+	if(argc <= sizeof(buf) / sizeof(*buf))
+		args = buf;
 	else if((args = object_new(sizeof(*args) * argc)) == NULL)
 		return NULL;
-	else
-		for(i = 0; i < argc; i++)
+	for(i = 0; i < argc; i++)
+	{
+		switch(call->args[i].direction)
 		{
-			args[i].direction = call->args[i].direction;
-			args[i].arg = argv[i];
+			case AICD_OUT:
+				/* not sent, only obtained from the reply */
+				args[i].direction = AMCD_OUT;
+				break;
+			case AICD_IN_OUT:
+				args[i].direction = AMCD_IN_OUT;
+				break;
+			default:
+				args[i].direction = AMCD_IN;
+				break;
 		}
+		args[i].arg = argv[i];
+	}
 	message = appmessage_new_call(call->name, args, argc);
-	object_delete(args);
+	if(args != buf)
+		object_delete(args);
+	if(message == NULL)
+		return NULL;
+	/* use the method ID when advertised by the server */
+	if(call->id != AMMI_NONE)
+		appmessage_set_method_id(message, call->id);
+	appmessage_set_interface_call(message, call);
 	return message;
 }
@@ -23,6 +23,7 @@
 # include "App/appserver.h"
 # include "App/appstatus.h"
 # include "App/apptransport.h"
+# include "appmessage.h"
 
 
 /* AppInterface */
@@ -39,12 +40,19 @@ void appinterface_delete(AppInterface * appinterface);
 /* accessors */
 int appinterface_can_call(AppInterface * appinterface, char const * method,
 		char const * name);
+int appinterface_can_call_message(AppInterface * appinterface,
+		AppMessage * message, AppTransportClient * client);
 
 char const * appinterface_get_app(AppInterface * appinterface);
 int appinterface_get_args_count(AppInterface * appinterface, size_t * count,
 		char const * function);
+/* one-way calls are sent without an ID (and not replied to) */
+int appinterface_get_oneway(AppInterface * appinterface, AppMessage * message);
 AppStatus * appinterface_get_status(AppInterface * appinterface);
 
+int appinterface_set_handshake(AppInterface * appinterface,
+		AppMessage * message);
+
 /* useful */
 int appinterface_callv(AppInterface * appinterface, App * app,
 		AppServerClient * asc, void ** result,
@@ -52,7 +60,11 @@ int appinterface_callv(AppInterface * appinterface, App * app,
 int appinterface_call_variablev(AppInterface * appinterface, App * app,
 		AppServerClient * asc, Variable * result, char const * method,
 		size_t argc, Variable ** argv);
+/* the reply carries the result and the AICD_{,IN_}OUT arguments */
+int appinterface_call_message(AppInterface * appinterface, App * app,
+		AppServerClient * asc, AppMessage * message, AppMessage ** reply);
 
+AppMessage * appinterface_message_handshake(AppInterface * appinterface);
 AppMessage * appinterface_messagev(AppInterface * appinterface,
 		char const * method, va_list args);
 AppMessage * appinterface_message_variables(AppInterface * appinterface,
@@ -60,4 +72,10 @@ AppMessage * appinterface_message_variables(AppInterface * appinterface,
 AppMessage * appinterface_message_variablev(AppInterface * appinterface,
 		char const * method, va_list args);
 
+int appinterface_replyv(AppInterface * appinterface, char const * method,
+		AppMessage * reply, void * result, va_list args);
+int appinterface_reply_variables(AppInterface * appinterface,
+		char const * method, AppMessage * reply, Variable * result,
+		Variable ** args);
+
 #endif /* !LIBAPP_APPINTERFACE_H */
@@ -16,48 +16,171 @@
 
 
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #ifdef DEBUG
 # include <stdio.h>
 #endif
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 #include <System.h>
+#include "App/appserver.h"
 #include "appmessage.h"
 
 
 /* AppMessage */
 /* private */
 /* types */
+typedef struct _AppMessageCallArg
+{
+	AppMessageCallDirection direction;
+	/* may be NULL until obtained from the view */
+	Variable * arg;
+
+	/* view on the frame, or on the copy owned below */
+	VariableType type;
+	char const * data;
+	size_t size;
+
+	/* strings and buffers are copied as views (serialized in place) */
+	String * string;
+	Buffer * buffer;
+} AppMessageCallArg;
+
 struct _AppMessage
 {
 	AppMessageType type;
 	AppMessageID id;
 
+	/* the data may be borrowed from this frame */
+	AppMessageFrame * frame;
+	/* the message may be recycled into this pool */
+	AppMessagePool * pool;
+	/* the call resolved by AppInterface */
+	struct _AppInterfaceCall * interface_call;
+	/* acknowledgements carried along (ranges of IDs, first and last) */
+	AppMessageID * acks;
+	size_t acks_cnt;
+
 	union
 	{
 		struct
 		{
 			char * method;
-			AppMessageCallArgument * args;
+			/* replaces the method on the wire when known */
+			AppMessageMethodID method_id;
+			AppMessageCallArg * args;
 			size_t args_cnt;
+			size_t args_alloc;
+			/* avoids allocating the arguments in most cases */
+			AppMessageCallArg args_inline[APPSERVER_MAX_ARGUMENTS];
+
+			/* replies only (the arguments are AICD_{,IN_}OUT) */
+			int32_t code;
+			Variable * result;
 		} call;
+
+		struct
+		{
+			/* the index is the method ID */
+			char ** methods;
+			size_t methods_cnt;
+		} handshake;
+
+		struct
+		{
+			/* only calls */
+			AppMessage ** messages;
+			size_t messages_cnt;
+			size_t messages_alloc;
+		} batch;
 	} t;
 };
 
+struct _AppMessagePool
+{
+	/* messages may be released from other threads */
+	pthread_mutex_t mutex;
+
+	AppMessage ** messages;
+	size_t messages_cnt;
+	size_t messages_max;
+
+	AppMessagePoolStats stats;
+};
+
+struct _AppMessageFrame
+{
+	/* updated atomically (messages may be handled in other threads) */
+	unsigned int refcount;
+	char * data;
+	size_t size;
+};
+
+
+/* constants */
+/* flags the calls identified by their method ID on the wire */
+#define AMT_METHOD_ID	0x80
+/* flags the messages with an ID larger than 32 bits */
+#define AMT_ID64	0x40
+/* flags the messages carrying acknowledgements */
+#define AMT_ACKS	0x20
+
+
+/* prototypes */
+static AppMessage * _appmessage_new(AppMessagePool * pool);
+static AppMessage * _appmessage_new_call(char const * method);
+
+static int _appmessage_pool_recycle(AppMessagePool * pool,
+		AppMessage * message);
+
+static int _appmessage_call_copy(AppMessageCallArg * arg,
+		AppMessageCallDirection direction, Variable * variable);
+static int _appmessage_call_reserve(AppMessage * message, size_t count);
+static Variable * _appmessage_call_variable(AppMessageCallArg * arg);
+
+static int _appmessage_deserialize_uint8(char const * data, size_t size,
+		size_t * pos, uint8_t * u8);
+static int _appmessage_deserialize_uint16(char const * data, size_t size,
+		size_t * pos, uint16_t * u16);
+static int _appmessage_deserialize_uint32(char const * data, size_t size,
+		size_t * pos, uint32_t * u32);
+
 
 /* public */
 /* functions */
+/* appmessage_new_batch */
+AppMessage * appmessage_new_batch(void)
+{
+	AppMessage * message;
+
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s()\n", __func__);
+#endif
+	if((message = _appmessage_new(NULL)) == NULL)
+		return NULL;
+	message->type = AMT_BATCH;
+	message->id = 0;
+	message->t.batch.messages = NULL;
+	message->t.batch.messages_cnt = 0;
+	message->t.batch.messages_alloc = 0;
+	return message;
+}
+
+
 /* appmessage_new_acknowledgement */
 AppMessage * appmessage_new_acknowledgement(AppMessageID id)
 {
 	AppMessage * message;
 
 #ifdef DEBUG
-	fprintf(stderr, "DEBUG: %s(%u)\n", __func__, id);
+	fprintf(stderr, "DEBUG: %s(%llu)\n", __func__,
+			(unsigned long long)id);
 #endif
-	if((message = object_new(sizeof(*message))) == NULL)
+	if((message = _appmessage_new(NULL)) == NULL)
 		return NULL;
 	message->type = AMT_ACKNOWLEDGEMENT;
 	message->id = id;
@@ -75,25 +198,17 @@ AppMessage * appmessage_new_call(char const * method,
 #ifdef DEBUG
 	fprintf(stderr, "DEBUG: %s(\"%s\")\n", __func__, method);
 #endif
-	if((message = object_new(sizeof(*message))) == NULL)
+	if((message = _appmessage_new_call(method)) == NULL)
 		return NULL;
-	message->type = AMT_CALL;
-	message->id = 0;
-	message->t.call.method = string_new(method);
-	if((message->t.call.args = object_new(sizeof(*args) * args_cnt))
-			== NULL)
+	if(_appmessage_call_reserve(message, args_cnt) != 0)
 	{
-		message->t.call.args_cnt = 0;
 		appmessage_delete(message);
 		return NULL;
 	}
 	for(i = 0; i < args_cnt; i++)
-	{
-		message->t.call.args[i].direction = args[i].direction;
-		if((message->t.call.args[i].arg = variable_new_copy(
-						args[i].arg)) == NULL)
+		if(_appmessage_call_copy(&message->t.call.args[i],
+					args[i].direction, args[i].arg) != 0)
 			break;
-	}
 	message->t.call.args_cnt = i;
 	/* check for errors */
 	if(i != args_cnt)
@@ -113,17 +228,15 @@ AppMessage * appmessage_new_callv(char const * method, ...)
 	size_t i;
 	int type;
 	Variable * v;
-	AppMessageCallArgument * p;
 
-	if((message = object_new(sizeof(*message))) == NULL)
+	if((message = _appmessage_new_call(method)) == NULL)
 		return NULL;
-	message->type = AMT_CALL;
-	message->id = 0;
-	message->t.call.method = string_new(method);
-	message->t.call.args = NULL;
-	message->t.call.args_cnt = 0;
-	/* check for errors */
-	if(message->t.call.method == NULL)
+	/* count the arguments first */
+	va_start(ap, method);
+	for(i = 0; va_arg(ap, int) >= 0; i++)
+		va_arg(ap, void *);
+	va_end(ap);
+	if(_appmessage_call_reserve(message, i) != 0)
 	{
 		appmessage_delete(message);
 		return NULL;
@@ -132,23 +245,18 @@ AppMessage * appmessage_new_callv(char const * method, ...)
 	va_start(ap, method);
 	for(i = 0; (type = va_arg(ap, int)) >= 0; i++)
 	{
-		if((p = realloc(message->t.call.args, sizeof(*p) * (i + 1)))
-				== NULL)
-		{
-			error_set_code(-errno, "%s", strerror(errno));
-			appmessage_delete(message);
-			message = NULL;
-			break;
-		}
-		message->t.call.args = p;
-		if((v = variable_new(type, va_arg(ap, void *))) == NULL)
+		if((v = variable_new(type, va_arg(ap, void *))) == NULL
+				|| _appmessage_call_copy(
+					&message->t.call.args[i],
+					AMCD_IN, v) != 0) /* XXX */
 		{
+			if(v != NULL)
+				variable_delete(v);
 			appmessage_delete(message);
 			message = NULL;
 			break;
 		}
-		message->t.call.args[i].direction = AMCD_IN; /* XXX */
-		message->t.call.args[i].arg = v;
+		variable_delete(v);
 		message->t.call.args_cnt = i + 1;
 	}
 	va_end(ap);
@@ -163,17 +271,14 @@ AppMessage * appmessage_new_callv_variables(char const * method, ...)
 	va_list ap;
 	size_t i;
 	Variable * v;
-	AppMessageCallArgument * p;
 
-	if((message = object_new(sizeof(*message))) == NULL)
+	if((message = _appmessage_new_call(method)) == NULL)
 		return NULL;
-	message->type = AMT_CALL;
-	message->id = 0;
-	message->t.call.method = string_new(method);
-	message->t.call.args = NULL;
-	message->t.call.args_cnt = 0;
-	/* check for errors */
-	if(message->t.call.method == NULL)
+	/* count the arguments first */
+	va_start(ap, method);
+	for(i = 0; va_arg(ap, Variable *) != NULL; i++);
+	va_end(ap);
+	if(_appmessage_call_reserve(message, i) != 0)
 	{
 		appmessage_delete(message);
 		return NULL;
@@ -182,23 +287,13 @@ AppMessage * appmessage_new_callv_variables(char const * method, ...)
 	va_start(ap, method);
 	for(i = 0; (v = va_arg(ap, Variable *)) != NULL; i++)
 	{
-		if((p = realloc(message->t.call.args, sizeof(*p) * (i + 1)))
-				== NULL)
-		{
-			error_set_code(-errno, "%s", strerror(errno));
-			appmessage_delete(message);
-			message = NULL;
-			break;
-		}
-		message->t.call.args = p;
-		if((v = variable_new_copy(v)) == NULL)
+		if(_appmessage_call_copy(&message->t.call.args[i], AMCD_IN,
+					v) != 0) /* FIXME */
 		{
 			appmessage_delete(message);
 			message = NULL;
 			break;
 		}
-		message->t.call.args[i].direction = AMCD_IN; /* FIXME */
-		message->t.call.args[i].arg = v;
 		message->t.call.args_cnt = i + 1;
 	}
 	va_end(ap);
@@ -207,201 +302,829 @@ AppMessage * appmessage_new_callv_variables(char const * method, ...)
 
 
 /* appmessage_new_deserialize */
+AppMessage * appmessage_new_deserialize(Buffer * buffer)
+{
+	AppMessage * message;
+	size_t size = buffer_get_size(buffer);
+	char * data;
+	AppMessageFrame * frame;
+
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s()\n", __func__);
+#endif
+	/* copy the data only once, the message borrows from it */
+	if((data = malloc(size)) == NULL && size > 0)
+	{
+		error_set_code(-errno, "%s", strerror(errno));
+		return NULL;
+	}
+	memcpy(data, buffer_get_data(buffer), size);
+	if((frame = appmessage_frame_new(data, size)) == NULL)
+	{
+		free(data);
+		return NULL;
+	}
+	message = appmessage_new_deserialize_frame(frame, 0, size);
+	appmessage_frame_unref(frame);
+	return message;
+}
+
+
+/* appmessage_new_deserialize_frame */
 static AppMessage * _new_deserialize_acknowledgement(AppMessage * message,
-		char const * data, const size_t size, size_t pos);
+		char const * data, const size_t size, size_t pos, bool id64);
+static int _new_deserialize_acks(AppMessage * message, char const * data,
+		const size_t size, size_t * pos, bool id64);
+static AppMessage * _new_deserialize_batch(AppMessage * message,
+		size_t offset, const size_t size, size_t pos, bool id64);
 static AppMessage * _new_deserialize_call(AppMessage * message,
+		char const * data, const size_t size, size_t pos,
+		bool id64, bool method_id);
+static int _new_deserialize_call_arg(AppMessageCallArg * arg,
+		char const * data, const size_t size, size_t * pos);
+static AppMessage * _new_deserialize_call_args(AppMessage * message,
 		char const * data, const size_t size, size_t pos);
+static AppMessage * _new_deserialize_handshake(AppMessage * message,
+		char const * data, const size_t size, size_t pos, bool id64);
+static AppMessage * _new_deserialize_reply(AppMessage * message,
+		char const * data, const size_t size, size_t pos, bool id64);
 static AppMessage * _new_deserialize_id(AppMessage * message, char const * data,
-		const size_t size, size_t * pos);
+		const size_t size, size_t * pos, bool id64);
 
-AppMessage * appmessage_new_deserialize(Buffer * buffer)
+AppMessage * appmessage_new_deserialize_frame(AppMessageFrame * frame,
+		size_t offset, size_t size)
+{
+	return appmessage_new_deserialize_pool(NULL, frame, offset, size);
+}
+
+
+/* appmessage_new_deserialize_pool */
+AppMessage * appmessage_new_deserialize_pool(AppMessagePool * pool,
+		AppMessageFrame * frame, size_t offset, size_t size)
 {
 	AppMessage * message;
-	char const * data = buffer_get_data(buffer);
-	size_t size = buffer_get_size(buffer);
+	char const * data = &frame->data[offset];
 	size_t pos = 0;
-	size_t s;
-	Variable * v;
 	uint8_t u8;
+	bool id64;
 
 #ifdef DEBUG
-	fprintf(stderr, "DEBUG: %s()\n", __func__);
+	fprintf(stderr, "DEBUG: %s(%zu, %zu)\n", __func__, offset, size);
 #endif
-	if((message = object_new(sizeof(*message))) == NULL)
+	if(offset > frame->size || size > frame->size - offset)
+	{
+		error_set_code(-ERANGE, "%s", strerror(ERANGE));
 		return NULL;
-	s = size;
-	if((v = variable_new_deserialize_type(VT_UINT8, &s, &data[pos]))
-			== NULL)
+	}
+	if(_appmessage_deserialize_uint8(data, size, &pos, &u8) != 0)
+		return NULL;
+	if((message = _appmessage_new(pool)) == NULL)
+		return NULL;
+	message->frame = appmessage_frame_ref(frame);
+	/* the ID may be encoded on 64 bits */
+	id64 = (u8 & AMT_ID64) ? true : false;
+	/* acknowledgements may be carried along (nothing else to free yet) */
+	message->type = AMT_ACKNOWLEDGEMENT;
+	if((u8 & AMT_ACKS) && _new_deserialize_acks(message, data, size, &pos,
+				id64) != 0)
 	{
-		object_delete(message);
+		appmessage_delete(message);
 		return NULL;
 	}
-	pos += s;
-	size -= s;
-	/* XXX may fail */
-	variable_get_as(v, VT_UINT8, &u8, NULL);
-	variable_delete(v);
-	switch((message->type = u8))
+	u8 &= ~(AMT_ID64 | AMT_ACKS);
+	message->type = u8;
+	switch(u8)
 	{
 		case AMT_ACKNOWLEDGEMENT:
 			return _new_deserialize_acknowledgement(message, data,
-					size, pos);
+					size, pos, id64);
 		case AMT_CALL:
-			return _new_deserialize_call(message, data, size, pos);
+			return _new_deserialize_call(message, data, size, pos,
+					id64, false);
+		case AMT_CALL | AMT_METHOD_ID:
+			message->type = AMT_CALL;
+			return _new_deserialize_call(message, data, size, pos,
+					id64, true);
+		case AMT_HANDSHAKE:
+			return _new_deserialize_handshake(message, data, size,
+					pos, id64);
+		case AMT_BATCH:
+			return _new_deserialize_batch(message, offset, size,
+					pos, id64);
+		case AMT_REPLY:
+			return _new_deserialize_reply(message, data, size, pos,
+					id64);
 		default:
 			error_set_code(1, "%s%u", "Unknown message type ", u8);
 			/* XXX should not happen */
-			object_delete(message);
+			appmessage_delete(message);
 			return NULL;
 	}
 }
 
 static AppMessage * _new_deserialize_acknowledgement(AppMessage * message,
-		char const * data, const size_t size, size_t pos)
+		char const * data, const size_t size, size_t pos, bool id64)
 {
 #ifdef DEBUG
 	fprintf(stderr, "DEBUG: %s()\n", __func__);
 #endif
-	return _new_deserialize_id(message, data, size, &pos);
+	return _new_deserialize_id(message, data, size, &pos, id64);
 }
 
-static AppMessage * _new_deserialize_call(AppMessage * message,
-		char const * data, const size_t size, size_t pos)
+static int _new_deserialize_acks(AppMessage * message, char const * data,
+		const size_t size, size_t * pos, bool id64)
 {
-	size_t s;
-	Variable * v;
+	uint32_t cnt;
+	uint32_t u32;
+	uint32_t high = 0;
+	size_t i;
+
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s()\n", __func__);
+#endif
+	/* the acknowledgements are freed along with the message on errors */
+	if(_appmessage_deserialize_uint32(data, size, pos, &cnt) != 0)
+		return -1;
+	/* every range takes at least 8 bytes */
+	if(cnt == 0 || cnt > (size - *pos) / (sizeof(u32) * 2))
+		return -error_set_code(-ERANGE, "%s",
+				"Invalid acknowledgements");
+	if((message->acks = malloc(sizeof(*message->acks) * cnt * 2)) == NULL)
+		return -error_set_code(-errno, "%s", strerror(errno));
+	for(i = 0; i < cnt * 2; i++)
+	{
+		if((id64 && _appmessage_deserialize_uint32(data, size, pos,
+						&high) != 0)
+				|| _appmessage_deserialize_uint32(data, size,
+					pos, &u32) != 0)
+			return -1;
+		message->acks[i] = ((AppMessageID)high << 32) | u32;
+	}
+	message->acks_cnt = cnt;
+	return 0;
+}
+
+static AppMessage * _new_deserialize_batch(AppMessage * message,
+		size_t offset, const size_t size, size_t pos, bool id64)
+{
+	char const * data = &message->frame->data[offset];
+	uint32_t cnt;
+	uint32_t u32;
 	size_t i;
-	AppMessageCallArgument * p;
+	AppMessage * call;
 
 #ifdef DEBUG
 	fprintf(stderr, "DEBUG: %s()\n", __func__);
 #endif
-	if(_new_deserialize_id(message, data, size, &pos) == NULL)
+	message->t.batch.messages = NULL;
+	message->t.batch.messages_cnt = 0;
+	message->t.batch.messages_alloc = 0;
+	if(_new_deserialize_id(message, data, size, &pos, id64) == NULL)
+		return NULL;
+	if(_appmessage_deserialize_uint32(data, size, &pos, &cnt) != 0)
+	{
+		appmessage_delete(message);
+		return NULL;
+	}
+	/* every call is at least as large as its length */
+	if(cnt > (size - pos) / sizeof(u32))
+	{
+		error_set_code(1, "%s", "Not enough data for the batch");
+		appmessage_delete(message);
 		return NULL;
+	}
+	/* the calls borrow from the same frame */
+	for(i = 0; i < cnt; i++)
+	{
+		if(_appmessage_deserialize_uint32(data, size, &pos, &u32) != 0
+				|| u32 > size - pos)
+		{
+			error_set_code(1, "%s", "Not enough data for the"
+					" batch");
+			appmessage_delete(message);
+			return NULL;
+		}
+		/* do not recurse into nested batches (ignoring the flags) */
+		if(u32 == 0 || ((unsigned char)data[pos]
+					& ~(AMT_METHOD_ID | AMT_ID64
+						| AMT_ACKS)) != AMT_CALL)
+		{
+			error_set_code(1, "%s", "Only calls can be batched");
+			appmessage_delete(message);
+			return NULL;
+		}
+		if((call = appmessage_new_deserialize_pool(message->pool,
+						message->frame, offset + pos,
+						u32)) == NULL
+				|| appmessage_batch_append(message, call) != 0)
+		{
+			if(call != NULL)
+				appmessage_delete(call);
+			appmessage_delete(message);
+			return NULL;
+		}
+		pos += u32;
+	}
+	return message;
+}
+
+static AppMessage * _new_deserialize_call(AppMessage * message,
+		char const * data, const size_t size, size_t pos,
+		bool id64, bool method_id)
+{
+	char const * p;
+	uint16_t u16;
+
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s()\n", __func__);
+#endif
 	message->t.call.method = NULL;
-	message->t.call.args = NULL;
+	message->t.call.method_id = AMMI_NONE;
+	message->t.call.args = message->t.call.args_inline;
 	message->t.call.args_cnt = 0;
-	s = size;
-	if((v = variable_new_deserialize_type(VT_STRING, &s, &data[pos]))
-			== NULL)
+	message->t.call.args_alloc = APPSERVER_MAX_ARGUMENTS;
+	if(_new_deserialize_id(message, data, size, &pos, id64) == NULL)
+		return NULL;
+	if(method_id)
+	{
+		/* the method is only known to the peer's interface */
+		if(_appmessage_deserialize_uint16(data, size, &pos, &u16) != 0
+				|| u16 == AMMI_NONE)
+		{
+			error_set_code(1, "%s", "Could not obtain the"
+					" AppMessage call method ID");
+			appmessage_delete(message);
+			return NULL;
+		}
+		message->t.call.method_id = u16;
+	}
+	/* borrow the method name from the frame */
+	else if((p = memchr(&data[pos], '\0', size - pos)) == NULL)
 	{
 		error_set_code(1, "%s", "Could not obtain the AppMessage call"
 				" method");
 		appmessage_delete(message);
 		return NULL;
 	}
-	pos += s;
-	/* XXX may fail */
-	variable_get_as(v, VT_STRING, &message->t.call.method, NULL);
-	variable_delete(v);
+	else
+	{
+		message->t.call.method = (char *)&data[pos];
+		pos = p - data + 1;
 #ifdef DEBUG
-	fprintf(stderr, "DEBUG: %s() \"%s\"\n", __func__,
-			message->t.call.method);
+		fprintf(stderr, "DEBUG: %s() \"%s\"\n", __func__,
+				message->t.call.method);
 #endif
-	/* deserialize the arguments */
+	}
+	return _new_deserialize_call_args(message, data, size, pos);
+}
+
+static AppMessage * _new_deserialize_call_args(AppMessage * message,
+		char const * data, const size_t size, size_t pos)
+{
+	size_t i;
+
+	/* the arguments span until the end of the message */
 	for(i = 0; pos < size; i++)
 	{
 #ifdef DEBUG
 		fprintf(stderr, "DEBUG: %s() %lu\n", __func__, i);
 #endif
-		if((p = realloc(message->t.call.args, sizeof(*p) * (i + 1)))
-				== NULL)
+		/* the array is only grown past APPSERVER_MAX_ARGUMENTS */
+		if(_appmessage_call_reserve(message, i + 1) != 0)
 		{
-			error_set_code(-errno, "%s", strerror(errno));
 			appmessage_delete(message);
 			return NULL;
 		}
-		message->t.call.args = p;
-		s = size - pos;
-		if((v = variable_new_deserialize(&s, &data[pos])) == NULL)
+		if(_new_deserialize_call_arg(&message->t.call.args[i], data,
+					size, &pos) != 0)
 		{
 			appmessage_delete(message);
 			return NULL;
 		}
-#ifdef DEBUG
-		fprintf(stderr, "DEBUG: %s() %lu (%u)\n", __func__, i,
-				variable_get_type(v));
-#endif
-		pos += s;
-		message->t.call.args[i].direction = AMCD_IN; /* XXX */
-		message->t.call.args[i].arg = v;
 		message->t.call.args_cnt = i + 1;
 	}
 	return message;
 }
 
-static AppMessage * _new_deserialize_id(AppMessage * message, char const * data,
-		const size_t size, size_t * pos)
+static int _new_deserialize_call_arg(AppMessageCallArg * arg,
+		char const * data, const size_t size, size_t * pos)
 {
-	int ret = 0;
-	size_t s = size;
-	Variable * v;
+	size_t s = *pos;
+	uint8_t u8;
+	uint32_t u32;
+	char const * p;
+
+	arg->direction = AMCD_IN; /* XXX */
+	arg->arg = NULL;
+	arg->data = NULL;
+	arg->size = 0;
+	arg->string = NULL;
+	arg->buffer = NULL;
+	if(_appmessage_deserialize_uint8(data, size, &s, &u8) != 0)
+		return -1;
+	switch((arg->type = u8))
+	{
+		case VT_BUFFER:
+			/* borrow the contents of buffers */
+			if(_appmessage_deserialize_uint32(data, size, &s, &u32)
+					!= 0)
+				return -1;
+			if(u32 > size - s)
+				return -error_set_code(1, "%s",
+						"Not enough data for Buffer");
+			arg->data = &data[s];
+			arg->size = u32;
+			*pos = s + u32;
+			break;
+		case VT_STRING:
+			/* borrow the contents of strings */
+			if((p = memchr(&data[s], '\0', size - s)) == NULL)
+				return -error_set_code(1, "%s",
+						"Not enough data for String");
+			arg->data = &data[s];
+			arg->size = p - &data[s];
+			*pos = p - data + 1;
+			break;
+		default:
+			/* the other types are small enough to copy */
+			s = size - *pos;
+			if((arg->arg = variable_new_deserialize(&s,
+							&data[*pos])) == NULL)
+				return -1;
+			*pos += s;
+			break;
+	}
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s() (%u)\n", __func__, arg->type);
+#endif
+	return 0;
+}
+
+static AppMessage * _new_deserialize_handshake(AppMessage * message,
+		char const * data, const size_t size, size_t pos, bool id64)
+{
+	uint16_t u16;
+	size_t i;
+	char const * p;
 
 #ifdef DEBUG
 	fprintf(stderr, "DEBUG: %s()\n", __func__);
 #endif
-	if((v = variable_new_deserialize_type(VT_UINT32, &s, &data[*pos]))
-			== NULL)
+	message->t.handshake.methods = NULL;
+	message->t.handshake.methods_cnt = 0;
+	if(_new_deserialize_id(message, data, size, &pos, id64) == NULL)
+		return NULL;
+	if(_appmessage_deserialize_uint16(data, size, &pos, &u16) != 0)
 	{
-		error_set_code(1, "%s", "Could not obtain the AppMessage ID");
 		appmessage_delete(message);
 		return NULL;
 	}
-	ret = variable_get_as(v, VT_UINT32, &message->id, NULL);
-	variable_delete(v);
-	if(ret != 0)
+	if(u16 > 0 && (message->t.handshake.methods = malloc(
+					sizeof(*message->t.handshake.methods)
+					* u16)) == NULL)
 	{
+		error_set_code(-errno, "%s", strerror(errno));
 		appmessage_delete(message);
 		return NULL;
 	}
-	*pos += s;
+	/* borrow the method names from the frame */
+	for(i = 0; i < u16; i++)
+	{
+		if(pos >= size || (p = memchr(&data[pos], '\0', size - pos))
+				== NULL)
+		{
+			error_set_code(1, "%s", "Could not obtain the"
+					" AppMessage handshake method");
+			appmessage_delete(message);
+			return NULL;
+		}
+		message->t.handshake.methods[i] = (char *)&data[pos];
+		message->t.handshake.methods_cnt = i + 1;
+		pos = p - data + 1;
+	}
 	return message;
 }
 
-
-/* appmessage_delete */
-static void _delete_call(AppMessage * message);
-
-void appmessage_delete(AppMessage * message)
+static AppMessage * _new_deserialize_reply(AppMessage * message,
+		char const * data, const size_t size, size_t pos, bool id64)
 {
-	switch(message->type)
+	uint32_t u32;
+	uint8_t u8;
+	AppMessageCallArg result;
+
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s()\n", __func__);
+#endif
+	message->t.call.method = NULL;
+	message->t.call.method_id = AMMI_NONE;
+	message->t.call.args = message->t.call.args_inline;
+	message->t.call.args_cnt = 0;
+	message->t.call.args_alloc = APPSERVER_MAX_ARGUMENTS;
+	message->t.call.code = 0;
+	message->t.call.result = NULL;
+	if(_new_deserialize_id(message, data, size, &pos, id64) == NULL)
+		return NULL;
+	/* the code of the call, then whether a value was returned */
+	if(_appmessage_deserialize_uint32(data, size, &pos, &u32) != 0
+			|| _appmessage_deserialize_uint8(data, size, &pos, &u8)
+			!= 0)
 	{
-		case AMT_ACKNOWLEDGEMENT:
-			break;
-		case AMT_CALL:
-			_delete_call(message);
-			break;
+		error_set_code(1, "%s", "Could not obtain the AppMessage"
+				" reply");
+		appmessage_delete(message);
+		return NULL;
 	}
-	object_delete(message);
+	message->t.call.code = (int32_t)u32;
+	if(u8 != 0)
+	{
+		if(_new_deserialize_call_arg(&result, data, size, &pos) != 0
+				|| (message->t.call.result
+					= _appmessage_call_variable(&result))
+				== NULL)
+		{
+			appmessage_delete(message);
+			return NULL;
+		}
+	}
+	return _new_deserialize_call_args(message, data, size, pos);
 }
 
-static void _delete_call(AppMessage * message)
+static AppMessage * _new_deserialize_id(AppMessage * message, char const * data,
+		const size_t size, size_t * pos, bool id64)
 {
-	size_t i;
-
-	for(i = 0; i < message->t.call.args_cnt; i++)
-		variable_delete(message->t.call.args[i].arg);
-	free(message->t.call.args);
-	string_delete(message->t.call.method);
-}
+	uint32_t u32;
+	uint32_t high = 0;
 
-
-/* accessors */
-/* appmessage_get_id */
-AppMessageID appmessage_get_id(AppMessage * message)
-{
-	return message->id;
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s()\n", __func__);
+#endif
+	if((id64 && _appmessage_deserialize_uint32(data, size, pos, &high)
+				!= 0)
+			|| _appmessage_deserialize_uint32(data, size, pos,
+				&u32) != 0)
+	{
+		error_set_code(1, "%s", "Could not obtain the AppMessage ID");
+		appmessage_delete(message);
+		return NULL;
+	}
+	message->id = ((AppMessageID)high << 32) | u32;
+	return message;
 }
 
 
-/* appmessage_get_method */
-String const * appmessage_get_method(AppMessage * message)
+/* appmessage_new_handshake */
+AppMessage * appmessage_new_handshake(String const ** methods,
+		size_t methods_cnt)
 {
-	if(message->type == AMT_CALL)
-		return message->t.call.method;
-	return NULL;
-}
-
+	AppMessage * message;
+	size_t i;
+
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s(%zu)\n", __func__, methods_cnt);
+#endif
+	if(methods_cnt > AMMI_NONE)
+	{
+		error_set_code(-ERANGE, "%s", strerror(ERANGE));
+		return NULL;
+	}
+	if((message = _appmessage_new(NULL)) == NULL)
+		return NULL;
+	message->type = AMT_HANDSHAKE;
+	message->id = 0;
+	message->t.handshake.methods_cnt = 0;
+	if(methods_cnt == 0)
+		message->t.handshake.methods = NULL;
+	else if((message->t.handshake.methods = malloc(
+					sizeof(*message->t.handshake.methods)
+					* methods_cnt)) == NULL)
+	{
+		error_set_code(-errno, "%s", strerror(errno));
+		object_delete(message);
+		return NULL;
+	}
+	for(i = 0; i < methods_cnt; i++)
+	{
+		if((message->t.handshake.methods[i] = string_new(methods[i]))
+				== NULL)
+		{
+			appmessage_delete(message);
+			return NULL;
+		}
+		message->t.handshake.methods_cnt = i + 1;
+	}
+	return message;
+}
+
+
+/* appmessage_new_move */
+AppMessage * appmessage_new_move(AppMessage * message)
+{
+	AppMessage * ret;
+
+	/* not recycled: the message may outlive the pool */
+	if((ret = _appmessage_new(NULL)) == NULL)
+		return NULL;
+	ret->type = message->type;
+	ret->id = message->id;
+	ret->frame = message->frame;
+	ret->interface_call = message->interface_call;
+	ret->acks = message->acks;
+	ret->acks_cnt = message->acks_cnt;
+	ret->t = message->t;
+	if((ret->type == AMT_CALL || ret->type == AMT_REPLY)
+			&& message->t.call.args == message->t.call.args_inline)
+		ret->t.call.args = ret->t.call.args_inline;
+	/* the original message no longer owns anything */
+	message->type = AMT_ACKNOWLEDGEMENT;
+	message->frame = NULL;
+	message->interface_call = NULL;
+	message->acks = NULL;
+	message->acks_cnt = 0;
+	return ret;
+}
+
+
+/* appmessage_new_reply */
+AppMessage * appmessage_new_reply(AppMessageID id, int code, Variable * result,
+		Variable ** args, size_t args_cnt)
+{
+	AppMessage * message;
+	size_t i;
+
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s(%llu, %d)\n", __func__,
+			(unsigned long long)id, code);
+#endif
+	if((message = _appmessage_new(NULL)) == NULL)
+		return NULL;
+	message->type = AMT_REPLY;
+	message->id = id;
+	message->t.call.method = NULL;
+	message->t.call.method_id = AMMI_NONE;
+	message->t.call.args = message->t.call.args_inline;
+	message->t.call.args_cnt = 0;
+	message->t.call.args_alloc = APPSERVER_MAX_ARGUMENTS;
+	message->t.call.code = code;
+	message->t.call.result = NULL;
+	if((result != NULL && (message->t.call.result = variable_new_copy(
+						result)) == NULL)
+			|| _appmessage_call_reserve(message, args_cnt) != 0)
+	{
+		appmessage_delete(message);
+		return NULL;
+	}
+	for(i = 0; i < args_cnt; i++)
+	{
+		/* the values are sent back */
+		if(_appmessage_call_copy(&message->t.call.args[i], AMCD_IN,
+					args[i]) != 0)
+			break;
+		message->t.call.args_cnt = i + 1;
+	}
+	/* check for errors */
+	if(i != args_cnt)
+	{
+		appmessage_delete(message);
+		return NULL;
+	}
+	return message;
+}
+
+
+/* appmessage_delete */
+static void _delete_batch(AppMessage * message);
+static void _delete_call(AppMessage * message);
+static void _delete_handshake(AppMessage * message);
+static void _delete_reply(AppMessage * message);
+
+void appmessage_delete(AppMessage * message)
+{
+	switch(message->type)
+	{
+		case AMT_ACKNOWLEDGEMENT:
+			break;
+		case AMT_CALL:
+			_delete_call(message);
+			break;
+		case AMT_HANDSHAKE:
+			_delete_handshake(message);
+			break;
+		case AMT_BATCH:
+			_delete_batch(message);
+			break;
+		case AMT_REPLY:
+			_delete_reply(message);
+			break;
+	}
+	free(message->acks);
+	if(message->frame != NULL)
+		appmessage_frame_unref(message->frame);
+	if(message->pool != NULL
+			&& _appmessage_pool_recycle(message->pool, message)
+			== 0)
+		return;
+	object_delete(message);
+}
+
+static void _delete_batch(AppMessage * message)
+{
+	size_t i;
+
+	for(i = 0; i < message->t.batch.messages_cnt; i++)
+		appmessage_delete(message->t.batch.messages[i]);
+	free(message->t.batch.messages);
+}
+
+static void _delete_call(AppMessage * message)
+{
+	size_t i;
+
+	for(i = 0; i < message->t.call.args_cnt; i++)
+	{
+		if(message->t.call.args[i].arg != NULL)
+			variable_delete(message->t.call.args[i].arg);
+		if(message->t.call.args[i].string != NULL)
+			string_delete(message->t.call.args[i].string);
+		if(message->t.call.args[i].buffer != NULL)
+			buffer_delete(message->t.call.args[i].buffer);
+	}
+	if(message->t.call.args != message->t.call.args_inline)
+	{
+		free(message->t.call.args);
+		message->t.call.args = message->t.call.args_inline;
+	}
+	/* the method may be borrowed from the frame */
+	if(message->frame == NULL && message->t.call.method != NULL)
+		string_delete(message->t.call.method);
+}
+
+static void _delete_handshake(AppMessage * message)
+{
+	size_t i;
+
+	/* the methods may be borrowed from the frame */
+	if(message->frame == NULL)
+		for(i = 0; i < message->t.handshake.methods_cnt; i++)
+			string_delete(message->t.handshake.methods[i]);
+	free(message->t.handshake.methods);
+}
+
+static void _delete_reply(AppMessage * message)
+{
+	if(message->t.call.result != NULL)
+		variable_delete(message->t.call.result);
+	_delete_call(message);
+}
+
+
+/* accessors */
+/* appmessage_get_acknowledgements */
+size_t appmessage_get_acknowledgements(AppMessage * message,
+		AppMessageID const ** acks)
+{
+	*acks = message->acks;
+	return message->acks_cnt;
+}
+
+
+/* appmessage_get_argument */
+Variable * appmessage_get_argument(AppMessage * message, size_t index)
+{
+	if((message->type != AMT_CALL && message->type != AMT_REPLY)
+			|| index >= message->t.call.args_cnt)
+	{
+		error_set_code(-ERANGE, "%s", strerror(ERANGE));
+		return NULL;
+	}
+	return _appmessage_call_variable(&message->t.call.args[index]);
+}
+
+
+/* appmessage_get_argument_data */
+int appmessage_get_argument_data(AppMessage * message, size_t index,
+		VariableType * type, void const ** data, size_t * size)
+{
+	AppMessageCallArg * arg;
+
+	if((message->type != AMT_CALL && message->type != AMT_REPLY)
+			|| index >= message->t.call.args_cnt)
+		return -error_set_code(-ERANGE, "%s", strerror(ERANGE));
+	arg = &message->t.call.args[index];
+	if(arg->data == NULL)
+		return -error_set_code(1, "%s", "Argument not available as"
+				" data");
+	if(type != NULL)
+		*type = arg->type;
+	*data = arg->data;
+	*size = arg->size;
+	return 0;
+}
+
+
+/* appmessage_get_arguments_count */
+size_t appmessage_get_arguments_count(AppMessage * message)
+{
+	if(message->type == AMT_CALL || message->type == AMT_REPLY)
+		return message->t.call.args_cnt;
+	return 0;
+}
+
+
+/* appmessage_get_batch_message */
+AppMessage * appmessage_get_batch_message(AppMessage * message, size_t index)
+{
+	if(message->type != AMT_BATCH || index >= message->t.batch.messages_cnt)
+	{
+		error_set_code(-ERANGE, "%s", strerror(ERANGE));
+		return NULL;
+	}
+	return message->t.batch.messages[index];
+}
+
+
+/* appmessage_get_batch_messages_count */
+size_t appmessage_get_batch_messages_count(AppMessage * message)
+{
+	if(message->type == AMT_BATCH)
+		return message->t.batch.messages_cnt;
+	return 0;
+}
+
+
+/* appmessage_get_handshake_method */
+String const * appmessage_get_handshake_method(AppMessage * message,
+		AppMessageMethodID id)
+{
+	if(message->type != AMT_HANDSHAKE
+			|| id >= message->t.handshake.methods_cnt)
+	{
+		error_set_code(-ERANGE, "%s", strerror(ERANGE));
+		return NULL;
+	}
+	return message->t.handshake.methods[id];
+}
+
+
+/* appmessage_get_handshake_methods_count */
+size_t appmessage_get_handshake_methods_count(AppMessage * message)
+{
+	if(message->type == AMT_HANDSHAKE)
+		return message->t.handshake.methods_cnt;
+	return 0;
+}
+
+
+/* appmessage_get_id */
+AppMessageID appmessage_get_id(AppMessage * message)
+{
+	return message->id;
+}
+
+
+/* appmessage_get_interface_call */
+struct _AppInterfaceCall * appmessage_get_interface_call(AppMessage * message)
+{
+	return message->interface_call;
+}
+
+
+/* appmessage_get_method */
+String const * appmessage_get_method(AppMessage * message)
+{
+	if(message->type == AMT_CALL)
+		return message->t.call.method;
+	return NULL;
+}
+
+
+/* appmessage_get_method_id */
+int appmessage_get_method_id(AppMessage * message, AppMessageMethodID * id)
+{
+	if(message->type != AMT_CALL
+			|| message->t.call.method_id == AMMI_NONE)
+		return -error_set_code(1, "%s", "No method ID available");
+	*id = message->t.call.method_id;
+	return 0;
+}
+
+
+/* appmessage_get_reply_code */
+int appmessage_get_reply_code(AppMessage * message)
+{
+	if(message->type != AMT_REPLY)
+		return 0;
+	return message->t.call.code;
+}
+
+
+/* appmessage_get_reply_result */
+Variable * appmessage_get_reply_result(AppMessage * message)
+{
+	if(message->type != AMT_REPLY)
+		return NULL;
+	return message->t.call.result;
+}
+
 
 /* appmessage_get_type */
 AppMessageType appmessage_get_type(AppMessage * message)
@@ -410,6 +1133,30 @@ AppMessageType appmessage_get_type(AppMessage * message)
 }
 
 
+/* appmessage_set_acknowledgements */
+int appmessage_set_acknowledgements(AppMessage * message,
+		AppMessageID const * acks, size_t acks_cnt)
+{
+	AppMessageID * p;
+
+	if(acks_cnt == 0)
+	{
+		free(message->acks);
+		message->acks = NULL;
+		message->acks_cnt = 0;
+		return 0;
+	}
+	if(acks_cnt > UINT32_MAX)
+		return -error_set_code(-ERANGE, "%s", strerror(ERANGE));
+	if((p = realloc(message->acks, sizeof(*p) * acks_cnt * 2)) == NULL)
+		return -error_set_code(-errno, "%s", strerror(errno));
+	memcpy(p, acks, sizeof(*p) * acks_cnt * 2);
+	message->acks = p;
+	message->acks_cnt = acks_cnt;
+	return 0;
+}
+
+
 /* appmessage_set_id */
 void appmessage_set_id(AppMessage * message, AppMessageID id)
 {
@@ -417,31 +1164,341 @@ void appmessage_set_id(AppMessage * message, AppMessageID id)
 }
 
 
+/* appmessage_set_interface_call */
+void appmessage_set_interface_call(AppMessage * message,
+		struct _AppInterfaceCall * call)
+{
+	message->interface_call = call;
+}
+
+
+/* appmessage_set_method_id */
+int appmessage_set_method_id(AppMessage * message, AppMessageMethodID id)
+{
+	if(message->type != AMT_CALL)
+		return -error_set_code(1, "%s", "Not a call");
+	message->t.call.method_id = id;
+	return 0;
+}
+
+
+/* pools */
+/* appmessage_pool_new */
+AppMessagePool * appmessage_pool_new(size_t size)
+{
+	AppMessagePool * pool;
+
+	if((pool = object_new(sizeof(*pool))) == NULL)
+		return NULL;
+	pool->messages_cnt = 0;
+	pool->messages_max = size;
+	memset(&pool->stats, 0, sizeof(pool->stats));
+	if(size == 0)
+		pool->messages = NULL;
+	else if((pool->messages = malloc(sizeof(*pool->messages) * size))
+			== NULL)
+	{
+		error_set_code(-errno, "%s", strerror(errno));
+		object_delete(pool);
+		return NULL;
+	}
+	if(pthread_mutex_init(&pool->mutex, NULL) != 0)
+	{
+		free(pool->messages);
+		object_delete(pool);
+		return NULL;
+	}
+	return pool;
+}
+
+
+/* appmessage_pool_delete */
+void appmessage_pool_delete(AppMessagePool * pool)
+{
+	size_t i;
+
+	for(i = 0; i < pool->messages_cnt; i++)
+		object_delete(pool->messages[i]);
+	free(pool->messages);
+	pthread_mutex_destroy(&pool->mutex);
+	object_delete(pool);
+}
+
+
+/* appmessage_pool_get_stats */
+void appmessage_pool_get_stats(AppMessagePool * pool,
+		AppMessagePoolStats * stats)
+{
+	pthread_mutex_lock(&pool->mutex);
+	*stats = pool->stats;
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+
+/* frames */
+/* appmessage_frame_new */
+AppMessageFrame * appmessage_frame_new(char * data, size_t size)
+{
+	AppMessageFrame * frame;
+
+	if((frame = object_new(sizeof(*frame))) == NULL)
+		return NULL;
+	frame->refcount = 1;
+	frame->data = data;
+	frame->size = size;
+	return frame;
+}
+
+
+/* appmessage_frame_get_data */
+char const * appmessage_frame_get_data(AppMessageFrame * frame)
+{
+	return frame->data;
+}
+
+
+/* appmessage_frame_get_size */
+size_t appmessage_frame_get_size(AppMessageFrame * frame)
+{
+	return frame->size;
+}
+
+
+/* appmessage_frame_ref */
+AppMessageFrame * appmessage_frame_ref(AppMessageFrame * frame)
+{
+	__sync_add_and_fetch(&frame->refcount, 1);
+	return frame;
+}
+
+
+/* appmessage_frame_unref */
+void appmessage_frame_unref(AppMessageFrame * frame)
+{
+	if(__sync_sub_and_fetch(&frame->refcount, 1) > 0)
+		return;
+	free(frame->data);
+	object_delete(frame);
+}
+
+
 /* useful */
+/* appmessage_batch_append */
+int appmessage_batch_append(AppMessage * message, AppMessage * call)
+{
+	AppMessage ** p;
+	size_t alloc;
+
+	if(message->type != AMT_BATCH)
+		return -error_set_code(1, "%s", "Not a batch");
+	if(call->type != AMT_CALL)
+		return -error_set_code(1, "%s", "Only calls can be batched");
+	if(message->t.batch.messages_cnt == message->t.batch.messages_alloc)
+	{
+		alloc = (message->t.batch.messages_alloc > 0)
+			? message->t.batch.messages_alloc * 2 : 4;
+		if((p = realloc(message->t.batch.messages, sizeof(*p) * alloc))
+				== NULL)
+			return -error_set_code(-errno, "%s", strerror(errno));
+		message->t.batch.messages = p;
+		message->t.batch.messages_alloc = alloc;
+	}
+	message->t.batch.messages[message->t.batch.messages_cnt++] = call;
+	return 0;
+}
+
+
 /* appmessage_serialize */
 static int _serialize_acknowledgement(AppMessage * message, Buffer * buffer,
-		Buffer * b);
-static int _serialize_append(Buffer * buffer, Buffer * b);
-static int _serialize_call(AppMessage * message, Buffer * buffer, Buffer * b);
-static int _serialize_id(AppMessage * message, Buffer * buffer, Buffer * b);
-static int _serialize_type(AppMessage * message, Buffer * buffer, Buffer * b);
+		size_t * pos);
+static int _serialize_acks(AppMessage * message, Buffer * buffer,
+		size_t * pos);
+static int _serialize_batch(AppMessage * message, Buffer * buffer,
+		size_t * pos);
+static int _serialize_call(AppMessage * message, Buffer * buffer,
+		size_t * pos);
+static int _serialize_call_args(AppMessage * message, Buffer * buffer,
+		size_t * pos);
+static int _serialize_data(Buffer * buffer, size_t * pos, void const * data,
+		size_t size);
+static int _serialize_handshake(AppMessage * message, Buffer * buffer,
+		size_t * pos);
+static int _serialize_message(AppMessage * message, Buffer * buffer,
+		size_t * pos);
+static int _serialize_reply(AppMessage * message, Buffer * buffer,
+		size_t * pos);
+static size_t _serialize_size(AppMessage * message);
+static size_t _serialize_size_args(AppMessage * message);
+static size_t _serialize_size_variable(Variable * variable);
+static int _serialize_string(Buffer * buffer, size_t * pos,
+		String const * string);
+static int _serialize_id(AppMessage * message, Buffer * buffer,
+		size_t * pos);
+static bool _serialize_id64(AppMessage * message);
+static int _serialize_uint8(Buffer * buffer, size_t * pos, uint8_t u8);
+static int _serialize_uint16(Buffer * buffer, size_t * pos, uint16_t u16);
+static int _serialize_uint32(Buffer * buffer, size_t * pos, uint32_t u32);
+static int _serialize_variable(Buffer * buffer, size_t * pos,
+		Variable * variable, Buffer ** b);
+static int _serialize_variable_other(Buffer * buffer, size_t * pos,
+		Variable * variable, Buffer ** b);
+static int _serialize_view(Buffer * buffer, size_t * pos,
+		AppMessageCallArg * arg);
 
 int appmessage_serialize(AppMessage * message, Buffer * buffer)
 {
-	Buffer * b;
+	int ret;
+	size_t pos = 0;
+
+	/* grow the output buffer only once */
+	if(buffer_set_size(buffer, _serialize_size(message)) != 0)
+		return -1;
+	if((ret = _serialize_message(message, buffer, &pos)) != 0)
+		return ret;
+	/* the estimate may have been too large */
+	return buffer_set_size(buffer, pos);
+}
+
+static int _serialize_acknowledgement(AppMessage * message, Buffer * buffer,
+		size_t * pos)
+{
+	return _serialize_id(message, buffer, pos);
+}
+
+static int _serialize_acks(AppMessage * message, Buffer * buffer,
+		size_t * pos)
+{
+	bool id64 = _serialize_id64(message);
+	size_t i;
+
+	if(_serialize_uint32(buffer, pos, message->acks_cnt) != 0)
+		return -1;
+	for(i = 0; i < message->acks_cnt * 2; i++)
+		if((id64 && _serialize_uint32(buffer, pos,
+						message->acks[i] >> 32) != 0)
+				|| _serialize_uint32(buffer, pos,
+					message->acks[i] & UINT32_MAX) != 0)
+			return -1;
+	return 0;
+}
+
+static int _serialize_batch(AppMessage * message, Buffer * buffer,
+		size_t * pos)
+{
+	size_t i;
+	size_t p;
+
+	if(_serialize_id(message, buffer, pos) != 0
+			|| _serialize_uint32(buffer, pos,
+				message->t.batch.messages_cnt) != 0)
+		return -1;
+	for(i = 0; i < message->t.batch.messages_cnt; i++)
+	{
+		/* prefix every call with its length once known */
+		p = *pos;
+		*pos += sizeof(uint32_t);
+		if(_serialize_message(message->t.batch.messages[i], buffer,
+					pos) != 0
+				|| _serialize_uint32(buffer, &p,
+					*pos - p - sizeof(uint32_t)) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+static int _serialize_call(AppMessage * message, Buffer * buffer,
+		size_t * pos)
+{
+	if(_serialize_id(message, buffer, pos) != 0)
+		return -1;
+	if(message->t.call.method_id != AMMI_NONE)
+	{
+		if(_serialize_uint16(buffer, pos, message->t.call.method_id)
+				!= 0)
+			return -1;
+	}
+	else if(_serialize_string(buffer, pos, message->t.call.method) != 0)
+		return -1;
+	return _serialize_call_args(message, buffer, pos);
+}
+
+static int _serialize_call_args(AppMessage * message, Buffer * buffer,
+		size_t * pos)
+{
+	Buffer * b = NULL;
+	size_t i;
+
+	for(i = 0; i < message->t.call.args_cnt; i++)
+	{
+		if(message->t.call.args[i].direction == AMCD_OUT)
+			continue;
+		if(message->t.call.args[i].arg == NULL)
+		{
+			if(_serialize_view(buffer, pos,
+						&message->t.call.args[i]) != 0)
+				break;
+		}
+		else if(_serialize_variable(buffer, pos,
+					message->t.call.args[i].arg, &b) != 0)
+			break;
+	}
+	if(b != NULL)
+		buffer_delete(b);
+	return (i == message->t.call.args_cnt) ? 0 : -1;
+}
+
+static int _serialize_data(Buffer * buffer, size_t * pos, void const * data,
+		size_t size)
+{
+	if(buffer_set_data(buffer, *pos, data, size) != 0)
+		return -1;
+	*pos += size;
+	return 0;
+}
+
+static int _serialize_handshake(AppMessage * message, Buffer * buffer,
+		size_t * pos)
+{
+	size_t i;
 
-	if((b = buffer_new(0, NULL)) == NULL)
+	if(_serialize_id(message, buffer, pos) != 0
+			|| _serialize_uint16(buffer, pos,
+				message->t.handshake.methods_cnt) != 0)
 		return -1;
-	/* reset the output buffer */
-	buffer_set_size(buffer, 0);
-	if(_serialize_type(message, buffer, b) != 0)
+	for(i = 0; i < message->t.handshake.methods_cnt; i++)
+		if(_serialize_string(buffer, pos,
+					message->t.handshake.methods[i]) != 0)
+			return -1;
+	return 0;
+}
+
+static int _serialize_message(AppMessage * message, Buffer * buffer,
+		size_t * pos)
+{
+	uint8_t type = message->type;
+
+	if(message->type == AMT_CALL && message->t.call.method_id != AMMI_NONE)
+		type |= AMT_METHOD_ID;
+	if(_serialize_id64(message))
+		type |= AMT_ID64;
+	if(message->acks_cnt > 0)
+		type |= AMT_ACKS;
+	if(_serialize_uint8(buffer, pos, type) != 0
+			|| (message->acks_cnt > 0
+				&& _serialize_acks(message, buffer, pos) != 0))
 		return -1;
 	switch(message->type)
 	{
 		case AMT_ACKNOWLEDGEMENT:
-			return _serialize_acknowledgement(message, buffer, b);
+			return _serialize_acknowledgement(message, buffer, pos);
+		case AMT_BATCH:
+			return _serialize_batch(message, buffer, pos);
 		case AMT_CALL:
-			return _serialize_call(message, buffer, b);
+			return _serialize_call(message, buffer, pos);
+		case AMT_HANDSHAKE:
+			return _serialize_handshake(message, buffer, pos);
+		case AMT_REPLY:
+			return _serialize_reply(message, buffer, pos);
 		default:
 			return -error_set_code(1, "%s%u",
 					"Unable to serialize message type ",
@@ -449,67 +1506,486 @@ int appmessage_serialize(AppMessage * message, Buffer * buffer)
 	}
 }
 
-static int _serialize_acknowledgement(AppMessage * message, Buffer * buffer,
-		Buffer * b)
+static int _serialize_reply(AppMessage * message, Buffer * buffer,
+		size_t * pos)
 {
-	return _serialize_id(message, buffer, b);
+	Buffer * b = NULL;
+	int ret;
+
+	if(_serialize_id(message, buffer, pos) != 0
+			|| _serialize_uint32(buffer, pos, message->t.call.code)
+			!= 0
+			|| _serialize_uint8(buffer, pos,
+				(message->t.call.result != NULL) ? 1 : 0) != 0)
+		return -1;
+	if(message->t.call.result != NULL)
+	{
+		ret = _serialize_variable(buffer, pos, message->t.call.result,
+				&b);
+		if(b != NULL)
+			buffer_delete(b);
+		if(ret != 0)
+			return ret;
+	}
+	return _serialize_call_args(message, buffer, pos);
 }
 
-static int _serialize_append(Buffer * buffer, Buffer * b)
+static size_t _serialize_size(AppMessage * message)
 {
-	return buffer_set_data(buffer, buffer_get_size(buffer),
-			buffer_get_data(b), buffer_get_size(b));
+	size_t ret = sizeof(uint8_t) + sizeof(uint32_t);
+	bool id64 = _serialize_id64(message);
+	size_t i;
+
+	if(id64)
+		ret += sizeof(uint32_t);
+	if(message->acks_cnt > 0)
+		ret += sizeof(uint32_t) + message->acks_cnt * 2
+			* (id64 ? sizeof(uint64_t) : sizeof(uint32_t));
+	if(message->type == AMT_HANDSHAKE)
+	{
+		ret += sizeof(uint16_t);
+		for(i = 0; i < message->t.handshake.methods_cnt; i++)
+			ret += string_get_length(
+					message->t.handshake.methods[i]) + 1;
+		return ret;
+	}
+	if(message->type == AMT_BATCH)
+	{
+		ret += sizeof(uint32_t);
+		for(i = 0; i < message->t.batch.messages_cnt; i++)
+			ret += sizeof(uint32_t) + _serialize_size(
+					message->t.batch.messages[i]);
+		return ret;
+	}
+	if(message->type == AMT_REPLY)
+	{
+		ret += sizeof(uint32_t) + sizeof(uint8_t);
+		if(message->t.call.result != NULL)
+			ret += _serialize_size_variable(
+					message->t.call.result);
+		return ret + _serialize_size_args(message);
+	}
+	if(message->type != AMT_CALL)
+		return ret;
+	if(message->t.call.method_id != AMMI_NONE)
+		ret += sizeof(uint16_t);
+	else
+		ret += string_get_length(message->t.call.method) + 1;
+	return ret + _serialize_size_args(message);
 }
 
-static int _serialize_call(AppMessage * message, Buffer * buffer, Buffer * b)
+static size_t _serialize_size_args(AppMessage * message)
 {
-	int ret;
-	Variable * v;
+	size_t ret = 0;
 	size_t i;
 
-	if(_serialize_id(message, buffer, b) != 0)
-		return -1;
-	if((v = variable_new(VT_STRING, message->t.call.method)) == NULL)
-		return -1;
-	ret = (variable_serialize(v, b, 0) == 0
-			&& _serialize_append(buffer, b) == 0) ? 0 : -1;
-	variable_delete(v);
-	if(ret != 0)
-		return ret;
 	for(i = 0; i < message->t.call.args_cnt; i++)
 	{
 		if(message->t.call.args[i].direction == AMCD_OUT)
 			continue;
-		if(variable_serialize(message->t.call.args[i].arg, b, 1) != 0
-				|| _serialize_append(buffer, b) != 0)
-			break;
+		if(message->t.call.args[i].arg != NULL)
+			ret += _serialize_size_variable(
+					message->t.call.args[i].arg);
+		else if(message->t.call.args[i].type == VT_BUFFER)
+			ret += sizeof(uint8_t) + sizeof(uint32_t)
+				+ message->t.call.args[i].size;
+		else
+			ret += sizeof(uint8_t) + message->t.call.args[i].size
+				+ 1;
 	}
-	buffer_delete(b);
-	return (i == message->t.call.args_cnt) ? 0 : -1;
+	return ret;
 }
 
-static int _serialize_id(AppMessage * message, Buffer * buffer, Buffer * b)
+static size_t _serialize_size_variable(Variable * variable)
 {
-	int ret;
-	Variable * v;
+	/* the type is always prefixed */
+	switch(variable_get_type(variable))
+	{
+		case VT_NULL:
+			return sizeof(uint8_t);
+		case VT_BOOL:
+		case VT_INT8:
+		case VT_UINT8:
+			return sizeof(uint8_t) + sizeof(uint8_t);
+		case VT_INT16:
+		case VT_UINT16:
+			return sizeof(uint8_t) + sizeof(uint16_t);
+		case VT_INT32:
+		case VT_UINT32:
+			return sizeof(uint8_t) + sizeof(uint32_t);
+		default:
+			/* not known in advance (the buffer grows instead) */
+			return sizeof(uint8_t);
+	}
+}
 
-	if((v = variable_new(VT_UINT32, &message->id)) == NULL)
+static int _serialize_id(AppMessage * message, Buffer * buffer,
+		size_t * pos)
+{
+	/* only use 64 bits when necessary (flagged in the type) */
+	if(_serialize_id64(message) && _serialize_uint32(buffer, pos,
+				message->id >> 32) != 0)
 		return -1;
-	ret = (variable_serialize(v, b, 0) == 0
-			&& _serialize_append(buffer, b) == 0) ? 0 : -1;
-	variable_delete(v);
-	return ret;
+	return _serialize_uint32(buffer, pos, message->id & UINT32_MAX);
 }
 
-static int _serialize_type(AppMessage * message, Buffer * buffer, Buffer * b)
+static bool _serialize_id64(AppMessage * message)
 {
-	int ret;
-	Variable * v;
+	size_t i;
+
+	if(message->id > UINT32_MAX)
+		return true;
+	/* the acknowledgements are encoded like the ID */
+	for(i = 0; i < message->acks_cnt * 2; i++)
+		if(message->acks[i] > UINT32_MAX)
+			return true;
+	return false;
+}
 
-	if((v = variable_new(VT_UINT8, &message->type)) == NULL)
+static int _serialize_string(Buffer * buffer, size_t * pos,
+		String const * string)
+{
+	/* include the terminating NUL character */
+	return _serialize_data(buffer, pos, string,
+			string_get_length(string) + 1);
+}
+
+static int _serialize_uint8(Buffer * buffer, size_t * pos, uint8_t u8)
+{
+	return _serialize_data(buffer, pos, &u8, sizeof(u8));
+}
+
+static int _serialize_uint16(Buffer * buffer, size_t * pos, uint16_t u16)
+{
+	unsigned char buf[sizeof(u16)];
+
+	/* network byte order */
+	buf[0] = (u16 >> 8) & 0xff;
+	buf[1] = u16 & 0xff;
+	return _serialize_data(buffer, pos, buf, sizeof(buf));
+}
+
+static int _serialize_uint32(Buffer * buffer, size_t * pos, uint32_t u32)
+{
+	unsigned char buf[sizeof(u32)];
+
+	/* network byte order */
+	buf[0] = (u32 >> 24) & 0xff;
+	buf[1] = (u32 >> 16) & 0xff;
+	buf[2] = (u32 >> 8) & 0xff;
+	buf[3] = u32 & 0xff;
+	return _serialize_data(buffer, pos, buf, sizeof(buf));
+}
+
+static int _serialize_variable(Buffer * buffer, size_t * pos,
+		Variable * variable, Buffer ** b)
+{
+	VariableType type;
+	union
+	{
+		bool b;
+		int8_t i8;
+		uint8_t u8;
+		int16_t i16;
+		uint16_t u16;
+		int32_t i32;
+		uint32_t u32;
+	} u;
+
+	/* encode the fixed-size types directly */
+	switch((type = variable_get_type(variable)))
+	{
+		case VT_NULL:
+			return _serialize_uint8(buffer, pos, type);
+		case VT_BOOL:
+			if(variable_get_as(variable, type, &u.b, NULL) != 0)
+				return -1;
+			return (_serialize_uint8(buffer, pos, type) == 0
+					&& _serialize_uint8(buffer, pos,
+						u.b ? 1 : 0) == 0) ? 0 : -1;
+		case VT_INT8:
+			if(variable_get_as(variable, type, &u.i8, NULL) != 0)
+				return -1;
+			u.u8 = (uint8_t)u.i8;
+			break;
+		case VT_UINT8:
+			if(variable_get_as(variable, type, &u.u8, NULL) != 0)
+				return -1;
+			break;
+		case VT_INT16:
+			if(variable_get_as(variable, type, &u.i16, NULL) != 0)
+				return -1;
+			return (_serialize_uint8(buffer, pos, type) == 0
+					&& _serialize_uint16(buffer, pos,
+						(uint16_t)u.i16) == 0) ? 0 : -1;
+		case VT_UINT16:
+			if(variable_get_as(variable, type, &u.u16, NULL) != 0)
+				return -1;
+			return (_serialize_uint8(buffer, pos, type) == 0
+					&& _serialize_uint16(buffer, pos, u.u16)
+					== 0) ? 0 : -1;
+		case VT_INT32:
+			if(variable_get_as(variable, type, &u.i32, NULL) != 0)
+				return -1;
+			return (_serialize_uint8(buffer, pos, type) == 0
+					&& _serialize_uint32(buffer, pos,
+						(uint32_t)u.i32) == 0) ? 0 : -1;
+		case VT_UINT32:
+			if(variable_get_as(variable, type, &u.u32, NULL) != 0)
+				return -1;
+			return (_serialize_uint8(buffer, pos, type) == 0
+					&& _serialize_uint32(buffer, pos, u.u32)
+					== 0) ? 0 : -1;
+		default:
+			return _serialize_variable_other(buffer, pos, variable,
+					b);
+	}
+	/* 8-bit integers */
+	return (_serialize_uint8(buffer, pos, type) == 0
+			&& _serialize_uint8(buffer, pos, u.u8) == 0) ? 0 : -1;
+}
+
+static int _serialize_variable_other(Buffer * buffer, size_t * pos,
+		Variable * variable, Buffer ** b)
+{
+	/* let libSystem encode the other types (re-using a single buffer) */
+	if(*b == NULL && (*b = buffer_new(0, NULL)) == NULL)
 		return -1;
-	ret = (variable_serialize(v, b, 0) == 0
-			&& _serialize_append(buffer, b) == 0) ? 0 : -1;
-	variable_delete(v);
+	if(variable_serialize(variable, *b, 1) != 0)
+		return -1;
+	return _serialize_data(buffer, pos, buffer_get_data(*b),
+			buffer_get_size(*b));
+}
+
+
+static int _serialize_view(Buffer * buffer, size_t * pos,
+		AppMessageCallArg * arg)
+{
+	if(_serialize_uint8(buffer, pos, arg->type) != 0)
+		return -1;
+	switch(arg->type)
+	{
+		case VT_BUFFER:
+			if(_serialize_uint32(buffer, pos, arg->size) != 0)
+				return -1;
+			return _serialize_data(buffer, pos, arg->data,
+					arg->size);
+		case VT_STRING:
+			/* include the terminating NUL character */
+			return _serialize_data(buffer, pos, arg->data,
+					arg->size + 1);
+		default:
+			return -error_set_code(1, "%s", "Invalid argument");
+	}
+}
+
+/* private */
+/* functions */
+/* appmessage_new */
+static AppMessage * _appmessage_new(AppMessagePool * pool)
+{
+	AppMessage * message = NULL;
+
+	if(pool != NULL)
+	{
+		pthread_mutex_lock(&pool->mutex);
+		if(pool->messages_cnt > 0)
+		{
+			message = pool->messages[--pool->messages_cnt];
+			pool->stats.hits++;
+		}
+		else
+			pool->stats.misses++;
+		pthread_mutex_unlock(&pool->mutex);
+	}
+	if(message == NULL && (message = object_new(sizeof(*message)))
+			== NULL)
+		return NULL;
+	message->frame = NULL;
+	message->pool = pool;
+	message->interface_call = NULL;
+	message->acks = NULL;
+	message->acks_cnt = 0;
+	return message;
+}
+
+
+/* appmessage_pool_recycle */
+static int _appmessage_pool_recycle(AppMessagePool * pool,
+		AppMessage * message)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&pool->mutex);
+	if(pool->messages_cnt == pool->messages_max)
+	{
+		pool->stats.discarded++;
+		ret = -1;
+	}
+	else
+	{
+		pool->messages[pool->messages_cnt++] = message;
+		pool->stats.recycled++;
+	}
+	pthread_mutex_unlock(&pool->mutex);
 	return ret;
 }
+
+
+/* appmessage_new_call */
+static AppMessage * _appmessage_new_call(char const * method)
+{
+	AppMessage * message;
+
+	if((message = _appmessage_new(NULL)) == NULL)
+		return NULL;
+	message->type = AMT_CALL;
+	message->id = 0;
+	message->t.call.args = message->t.call.args_inline;
+	message->t.call.args_cnt = 0;
+	message->t.call.args_alloc = APPSERVER_MAX_ARGUMENTS;
+	message->t.call.method_id = AMMI_NONE;
+	if((message->t.call.method = string_new(method)) == NULL)
+	{
+		object_delete(message);
+		return NULL;
+	}
+	return message;
+}
+
+
+/* appmessage_call_copy */
+static int _appmessage_call_copy(AppMessageCallArg * arg,
+		AppMessageCallDirection direction, Variable * variable)
+{
+	arg->direction = direction;
+	arg->arg = NULL;
+	arg->data = NULL;
+	arg->size = 0;
+	arg->string = NULL;
+	arg->buffer = NULL;
+	switch((arg->type = variable_get_type(variable)))
+	{
+		case VT_BUFFER:
+			if(variable_get_as(variable, VT_BUFFER, &arg->buffer,
+						NULL) != 0)
+				return -1;
+			arg->size = buffer_get_size(arg->buffer);
+			/* empty buffers may not be allocated */
+			if((arg->data = buffer_get_data(arg->buffer)) == NULL)
+				arg->data = "";
+			return 0;
+		case VT_STRING:
+			if(variable_get_as(variable, VT_STRING, &arg->string,
+						NULL) != 0)
+				return -1;
+			arg->data = arg->string;
+			arg->size = string_get_length(arg->string);
+			return 0;
+		default:
+			/* the other types are small enough to copy */
+			return ((arg->arg = variable_new_copy(variable))
+					!= NULL) ? 0 : -1;
+	}
+}
+
+
+/* appmessage_call_reserve */
+static int _appmessage_call_reserve(AppMessage * message, size_t count)
+{
+	AppMessageCallArg * p;
+	size_t alloc;
+
+	if(count <= message->t.call.args_alloc)
+		return 0;
+	for(alloc = message->t.call.args_alloc * 2; alloc < count; alloc *= 2);
+	if(message->t.call.args == message->t.call.args_inline)
+	{
+		if((p = malloc(sizeof(*p) * alloc)) != NULL)
+			memcpy(p, message->t.call.args, sizeof(*p)
+					* message->t.call.args_cnt);
+	}
+	else
+		p = realloc(message->t.call.args, sizeof(*p) * alloc);
+	if(p == NULL)
+		return -error_set_code(-errno, "%s", strerror(errno));
+	message->t.call.args = p;
+	message->t.call.args_alloc = alloc;
+	return 0;
+}
+
+
+/* appmessage_call_variable */
+static Variable * _appmessage_call_variable(AppMessageCallArg * arg)
+{
+	size_t size;
+
+	if(arg->arg != NULL)
+		return arg->arg;
+	/* obtain the variable from the view (copying it only once) */
+	switch(arg->type)
+	{
+		case VT_BUFFER:
+			if(arg->buffer != NULL)
+			{
+				arg->arg = variable_new(VT_BUFFER, arg->buffer);
+				break;
+			}
+			/* decode it again from the frame, after its size */
+			size = sizeof(uint32_t) + arg->size;
+			arg->arg = variable_new_deserialize_type(VT_BUFFER,
+					&size, arg->data - sizeof(uint32_t));
+			break;
+		case VT_STRING:
+			arg->arg = variable_new(VT_STRING, arg->data);
+			break;
+		default:
+			error_set_code(1, "%s", "Invalid argument");
+			break;
+	}
+	return arg->arg;
+}
+
+
+/* appmessage_deserialize_uint8 */
+static int _appmessage_deserialize_uint8(char const * data, size_t size,
+		size_t * pos, uint8_t * u8)
+{
+	if(*pos >= size)
+		return -error_set_code(1, "%s", "Not enough data");
+	*u8 = (unsigned char)data[(*pos)++];
+	return 0;
+}
+
+
+/* appmessage_deserialize_uint16 */
+static int _appmessage_deserialize_uint16(char const * data, size_t size,
+		size_t * pos, uint16_t * u16)
+{
+	unsigned char const * p;
+
+	if(*pos > size || size - *pos < sizeof(*u16))
+		return -error_set_code(1, "%s", "Not enough data");
+	/* network byte order */
+	p = (unsigned char const *)&data[*pos];
+	*u16 = ((uint16_t)p[0] << 8) | p[1];
+	*pos += sizeof(*u16);
+	return 0;
+}
+
+
+/* appmessage_deserialize_uint32 */
+static int _appmessage_deserialize_uint32(char const * data, size_t size,
+		size_t * pos, uint32_t * u32)
+{
+	unsigned char const * p;
+
+	if(*pos > size || size - *pos < sizeof(*u32))
+		return -error_set_code(1, "%s", "Not enough data");
+	/* network byte order */
+	p = (unsigned char const *)&data[*pos];
+	*u32 = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+		| ((uint32_t)p[2] << 8) | p[3];
+	*pos += sizeof(*u32);
+	return 0;
+}
@@ -23,12 +23,48 @@
 
 
 /* AppMessage */
+/* types */
+typedef uint16_t AppMessageMethodID;
+# define AMMI_NONE	((AppMessageMethodID)0xffff)
+
+/* resolved by AppInterface */
+struct _AppInterfaceCall;
+
+
 /* functions */
 /* acknowledgement */
 AppMessage * appmessage_new_acknowledgement(AppMessageID id);
+/* handshake */
+AppMessage * appmessage_new_handshake(String const ** methods,
+		size_t methods_cnt);
+/* takes the content over (leaving an empty message) */
+AppMessage * appmessage_new_move(AppMessage * message);
+/* reply */
+AppMessage * appmessage_new_reply(AppMessageID id, int code, Variable * result,
+		Variable ** args, size_t args_cnt);
 
 /* accessors */
+/* acknowledgements carried by any message (ranges of IDs, first and last) */
+size_t appmessage_get_acknowledgements(AppMessage * message,
+		AppMessageID const ** acks);
+int appmessage_set_acknowledgements(AppMessage * message,
+		AppMessageID const * acks, size_t acks_cnt);
+
+String const * appmessage_get_handshake_method(AppMessage * message,
+		AppMessageMethodID id);
+size_t appmessage_get_handshake_methods_count(AppMessage * message);
+
+int appmessage_get_reply_code(AppMessage * message);
+Variable * appmessage_get_reply_result(AppMessage * message);
+
 AppMessageID appmessage_get_id(AppMessage * message);
 void appmessage_set_id(AppMessage * message, AppMessageID id);
 
+struct _AppInterfaceCall * appmessage_get_interface_call(AppMessage * message);
+void appmessage_set_interface_call(AppMessage * message,
+		struct _AppInterfaceCall * call);
+
+int appmessage_get_method_id(AppMessage * message, AppMessageMethodID * id);
+int appmessage_set_method_id(AppMessage * message, AppMessageMethodID id);
+
 #endif /* !LIBAPP_APPMESSAGE_H */
@@ -18,6 +18,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <pthread.h>
 #ifdef DEBUG
 # include <stdio.h>
 #endif
@@ -26,6 +27,7 @@
 #include <System.h>
 #include "App/appmessage.h"
 #include "App/appserver.h"
+#include "appmessage.h"
 #include "apptransport.h"
 #include "appinterface.h"
 #include "../config.h"
@@ -34,6 +36,52 @@
 /* AppServer */
 /* private */
 /* types */
+typedef struct _AppServerCall AppServerCall;
+
+typedef struct _AppServerQueue
+{
+	AppTransport * transport;
+
+	/* to wake the event loop up */
+	int pipe[2];
+	/* completed calls (lock-free) */
+	AppServerCall * done;
+} AppServerQueue;
+
+struct _AppServerCall
+{
+	AppServerCall * next;
+	AppServerQueue * queue;
+	AppTransportClient * client;
+	AppMessage * message;
+	/* posted back to the client (may be NULL) */
+	AppMessage * reply;
+
+	/* verdicts from the event loop (one per call) */
+	char * allowed;
+	size_t allowed_cnt;
+};
+
+typedef struct _AppServerThread
+{
+	AppServer * appserver;
+	pthread_t thread;
+	/* the client currently served */
+	AppTransportClient * client;
+} AppServerThread;
+
+typedef struct _AppServerWorker
+{
+	Event * event;
+	AppTransport * transport;
+	AppServerQueue queue;
+
+	/* to wake the event loop up */
+	int pipe[2];
+	pthread_t thread;
+	int running;
+} AppServerWorker;
+
 struct _AppServer
 {
 	App * app;
@@ -44,14 +92,59 @@ struct _AppServer
 	int event_free;
 	AppTransport * transport;
 	AppTransportHelper helper;
+
+	/* workers (with their own event loop and transport) */
+	AppServerWorker * workers;
+	size_t workers_cnt;
+
+	/* threads handling the calls */
+	AppServerThread * threads;
+	size_t threads_cnt;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	AppServerCall * calls;
+	AppServerCall ** calls_last;
+	size_t calls_cnt;
+	int calls_quit;
+	AppServerQueue queue;
 };
 
 
+/* constants */
+#define ASO_WORKERS_COUNT(options)	(((options) >> 8) & 0xff)
+#define ASO_THREADS_COUNT(options)	(((options) >> 16) & 0xff)
+
+/* calls waiting for a thread (refused with EAGAIN beyond) */
+#ifndef APPSERVER_CALLS_MAX
+# define APPSERVER_CALLS_MAX	1024
+#endif
+
+
 /* prototypes */
 /* helpers */
+static int _appserver_helper_dispatch(void * data, AppTransport * transport,
+		AppTransportClient * client, AppMessage * message);
 static int _appserver_helper_message(void * data, AppTransport * transport,
 		AppTransportClient * client, AppMessage * message);
 
+/* useful */
+static int _appserver_call(AppServer * appserver, AppMessage * message,
+		int allowed, AppMessage ** reply);
+
+/* calls */
+static void _appserver_call_delete(AppServerCall * call);
+static int _appserver_calls_start(AppServer * appserver);
+static void _appserver_calls_stop(AppServer * appserver);
+
+/* queues */
+static int _appserver_queue_init(AppServerQueue * queue, Event * event,
+		AppTransport * transport);
+static void _appserver_queue_destroy(AppServerQueue * queue, Event * event);
+
+/* workers */
+static int _appserver_workers_start(AppServer * appserver);
+static void _appserver_workers_stop(AppServer * appserver);
+
 
 /* public */
 /* functions */
@@ -64,6 +157,13 @@ AppServer * appserver_new(App * self, AppServerOptions options,
 
 
 /* appserver_new_event */
+static int _new_event_handshake(AppServer * appserver,
+		AppTransport * transport);
+static int _new_event_workers(AppServer * appserver, char const * app,
+		char const * name);
+static int _new_event_queue(AppServer * appserver, AppServerQueue * queue,
+		Event * event, AppTransport * transport);
+
 AppServer * appserver_new_event(App * self, AppServerOptions options,
 		char const * app, char const * name, Event * event)
 {
@@ -71,20 +171,54 @@ AppServer * appserver_new_event(App * self, AppServerOptions options,
 
 	if((appserver = object_new(sizeof(*appserver))) == NULL)
 		return NULL;
+	if(pthread_mutex_init(&appserver->mutex, NULL) != 0)
+	{
+		object_delete(appserver);
+		return NULL;
+	}
+	if(pthread_cond_init(&appserver->cond, NULL) != 0)
+	{
+		pthread_mutex_destroy(&appserver->mutex);
+		object_delete(appserver);
+		return NULL;
+	}
+	appserver->threads = NULL;
+	appserver->threads_cnt = 0;
+	appserver->calls = NULL;
+	appserver->calls_last = &appserver->calls;
+	appserver->calls_cnt = 0;
+	appserver->calls_quit = 0;
+	appserver->queue.pipe[0] = -1;
+	appserver->queue.pipe[1] = -1;
+	appserver->queue.done = NULL;
 	appserver->app = self;
 	appserver->name = string_new(app);
 	appserver->options = options;
 	appserver->interface = appinterface_new(ATM_SERVER, app);
 	appserver->helper.data = appserver;
 	appserver->helper.message = _appserver_helper_message;
+	/* the calls may be handled from other threads */
+	appserver->helper.dispatch = (ASO_THREADS_COUNT(options) > 0)
+		? _appserver_helper_dispatch : NULL;
+	/* the listening sockets are shared with the workers */
+	appserver->helper.flags = (ASO_WORKERS_COUNT(options) > 0)
+		? ATF_SHARED : 0;
 	appserver->event = (event != NULL) ? event : event_new();
 	appserver->event_free = (event != NULL) ? 0 : 1;
 	appserver->transport = apptransport_new_app(ATM_SERVER,
 			&appserver->helper, app, name, appserver->event);
+	appserver->workers = NULL;
+	appserver->workers_cnt = 0;
 	/* check for errors */
 	if(appserver->name == NULL || appserver->interface == NULL
 			|| appserver->transport == NULL
 			|| appserver->event == NULL
+			|| _new_event_handshake(appserver,
+				appserver->transport) != 0
+			|| _new_event_queue(appserver, &appserver->queue,
+				appserver->event, appserver->transport) != 0
+			|| _new_event_workers(appserver, app, name) != 0
+			|| _appserver_calls_start(appserver) != 0
 			|| (((options & ASO_REGISTER) == ASO_REGISTER)
 				&& appserver_register(appserver, NULL) != 0))
 	{
@@ -94,17 +228,102 @@ AppServer * appserver_new_event(App * self, AppServerOptions options,
 	return appserver;
 }
 
+static int _new_event_handshake(AppServer * appserver,
+		AppTransport * transport)
+{
+	AppMessage * message;
+
+	/* let the clients call the methods by ID */
+	if((message = appinterface_message_handshake(appserver->interface))
+			== NULL)
+		return -1;
+	if(apptransport_server_set_handshake(transport, message) != 0)
+	{
+		appmessage_delete(message);
+		return -1;
+	}
+	return 0;
+}
+
+static int _new_event_workers(AppServer * appserver, char const * app,
+		char const * name)
+{
+	size_t cnt = ASO_WORKERS_COUNT(appserver->options);
+	AppServerWorker * worker;
+
+	if(cnt == 0)
+		return 0;
+	if((appserver->workers = malloc(sizeof(*worker) * cnt)) == NULL)
+		return -error_set_code(-errno, "%s", strerror(errno));
+	while(appserver->workers_cnt < cnt)
+	{
+		worker = &appserver->workers[appserver->workers_cnt];
+		worker->transport = NULL;
+		worker->pipe[0] = -1;
+		worker->pipe[1] = -1;
+		worker->queue.pipe[0] = -1;
+		worker->queue.pipe[1] = -1;
+		worker->queue.done = NULL;
+		worker->running = 0;
+		if((worker->event = event_new()) == NULL)
+			return -1;
+		appserver->workers_cnt++;
+		/* every worker listens on its own socket */
+		if((worker->transport = apptransport_new_app(ATM_SERVER,
+						&appserver->helper, app, name,
+						worker->event)) == NULL
+				|| _new_event_handshake(appserver,
+					worker->transport) != 0
+				|| _new_event_queue(appserver, &worker->queue,
+					worker->event, worker->transport) != 0)
+			return -1;
+		if(pipe(worker->pipe) != 0)
+			return -error_set_code(-errno, "%s", strerror(errno));
+	}
+	return 0;
+}
+
+static int _new_event_queue(AppServer * appserver, AppServerQueue * queue,
+		Event * event, AppTransport * transport)
+{
+	/* the replies are only needed with threads */
+	if(ASO_THREADS_COUNT(appserver->options) == 0)
+		return 0;
+	return _appserver_queue_init(queue, event, transport);
+}
+
 
 /* appserver_delete */
 void appserver_delete(AppServer * appserver)
 {
+	size_t i;
+
 #ifdef DEBUG
 	fprintf(stderr, "DEBUG: %s()\n", __func__);
 #endif
+	_appserver_workers_stop(appserver);
+	/* the pending calls refer to the transports */
+	_appserver_calls_stop(appserver);
+	_appserver_queue_destroy(&appserver->queue, appserver->event);
+	for(i = 0; i < appserver->workers_cnt; i++)
+	{
+		_appserver_queue_destroy(&appserver->workers[i].queue,
+				appserver->workers[i].event);
+		if(appserver->workers[i].transport != NULL)
+			apptransport_delete(appserver->workers[i].transport);
+		if(appserver->workers[i].pipe[0] >= 0)
+			close(appserver->workers[i].pipe[0]);
+		if(appserver->workers[i].pipe[1] >= 0)
+			close(appserver->workers[i].pipe[1]);
+		event_delete(appserver->workers[i].event);
+	}
+	free(appserver->workers);
 	if(appserver->interface != NULL)
 		appinterface_delete(appserver->interface);
 	if(appserver->event_free != 0)
 		event_delete(appserver->event);
+	pthread_cond_destroy(&appserver->cond);
+	pthread_mutex_destroy(&appserver->mutex);
 	object_delete(appserver);
 }
 
@@ -128,10 +347,19 @@ AppStatus * appserver_get_status(AppServer * appserver)
 /* appserver_loop */
 int appserver_loop(AppServer * appserver)
 {
+	int ret;
+
 #ifdef DEBUG
 	fprintf(stderr, "DEBUG: %s()\n", __func__);
 #endif
-	return event_loop(appserver->event);
+	if(_appserver_workers_start(appserver) != 0)
+	{
+		_appserver_workers_stop(appserver);
+		return -1;
+	}
+	ret = event_loop(appserver->event);
+	_appserver_workers_stop(appserver);
+	return ret;
 }
 
 
@@ -144,6 +372,106 @@ int appserver_register(AppServer * appserver, char const * name)
 
 
 /* private */
+/* appserver_helper_dispatch */
+static void _helper_dispatch_busy(AppTransport * transport,
+		AppServerCall * call);
+static AppServerQueue * _helper_dispatch_queue(AppServer * appserver,
+		AppTransport * transport);
+
+static int _appserver_helper_dispatch(void * data, AppTransport * transport,
+		AppTransportClient * client, AppMessage * message)
+{
+	AppServer * appserver = data;
+	AppServerQueue * queue;
+	AppServerCall * call;
+	size_t cnt;
+	size_t i;
+	AppMessage * m;
+
+	switch(appmessage_get_type(message))
+	{
+		case AMT_CALL:
+			cnt = 1;
+			break;
+		case AMT_BATCH:
+			cnt = appmessage_get_batch_messages_count(message);
+			break;
+		default:
+			/* handled synchronously */
+			return -1;
+	}
+	if((queue = _helper_dispatch_queue(appserver, transport)) == NULL
+			|| (call = malloc(sizeof(*call) + cnt)) == NULL)
+		return -1;
+	call->next = NULL;
+	call->queue = queue;
+	call->reply = NULL;
+	call->allowed = (char *)(call + 1);
+	call->allowed_cnt = cnt;
+	/* the clients are only checked from their event loop */
+	for(i = 0; i < cnt; i++)
+	{
+		m = (appmessage_get_type(message) == AMT_BATCH)
+			? appmessage_get_batch_message(message, i) : message;
+		call->allowed[i] = (appinterface_can_call_message(
+					appserver->interface, m, client) > 0)
+			? 1 : 0;
+	}
+	if((call->message = appmessage_new_move(message)) == NULL)
+	{
+		free(call);
+		return -1;
+	}
+	call->client = apptransport_client_ref(client);
+	pthread_mutex_lock(&appserver->mutex);
+	if(appserver->calls_cnt >= APPSERVER_CALLS_MAX)
+	{
+		pthread_mutex_unlock(&appserver->mutex);
+		/* refuse the call instead of blocking the event loop */
+		_helper_dispatch_busy(transport, call);
+		_appserver_call_delete(call);
+		return 0;
+	}
+	*appserver->calls_last = call;
+	appserver->calls_last = &call->next;
+	appserver->calls_cnt++;
+	pthread_cond_broadcast(&appserver->cond);
+	pthread_mutex_unlock(&appserver->mutex);
+	return 0;
+}
+
+static void _helper_dispatch_busy(AppTransport * transport,
+		AppServerCall * call)
+{
+	AppMessageID id;
+	int res;
+
+	if((id = appmessage_get_id(call->message)) == 0)
+		/* nobody is waiting for this call */
+		return;
+	res = error_set_code(-EAGAIN, "%s", strerror(EAGAIN));
+	if((call->reply = appmessage_new_reply(id, res, NULL, NULL, 0))
+			== NULL)
+		return;
+	/* XXX we can ignore errors */
+	apptransport_server_reply(transport, call->client, call->message,
+			call->reply);
+}
+
+static AppServerQueue * _helper_dispatch_queue(AppServer * appserver,
+		AppTransport * transport)
+{
+	size_t i;
+
+	if(transport == appserver->transport)
+		return &appserver->queue;
+	for(i = 0; i < appserver->workers_cnt; i++)
+		if(transport == appserver->workers[i].transport)
+			return &appserver->workers[i].queue;
+	return NULL;
+}
+
+
 /* appserver_helper_message */
 static int _helper_message_call(AppServer * appserver, AppTransport * transport,
 		AppTransportClient * client, AppMessage * message);
@@ -174,19 +502,363 @@ static int _helper_message_call(AppServer * appserver, AppTransport * transport,
 		AppTransportClient * client, AppMessage * message)
 {
 	int ret;
-	String const * name;
-	String const * method;
-	Variable * result = NULL;
+	int allowed;
+	AppMessage * reply;
+
+	/* the call is resolved only once for the message */
+	allowed = (appinterface_can_call_message(appserver->interface, message,
+				client) > 0) ? 1 : 0;
+	ret = _appserver_call(appserver, message, allowed, &reply);
+	/* XXX we can ignore errors */
+	apptransport_server_reply(transport, client, message, reply);
+	if(reply != NULL)
+		appmessage_delete(reply);
+	return ret;
+}
+
+
+/* useful */
+/* appserver_call */
+static int _appserver_call(AppServer * appserver, AppMessage * message,
+		int allowed, AppMessage ** reply)
+{
+	int ret;
 
-	name = (client != NULL) ? apptransport_client_get_name(client) : NULL;
-	method = appmessage_get_method(message);
-	if(!appinterface_can_call(appserver->interface, method, name))
+	if(allowed == 0)
+	{
 		/* XXX report errors */
-		return -1;
+		ret = -EPERM;
+		*reply = (appmessage_get_id(message) != 0)
+			? appmessage_new_reply(appmessage_get_id(message), ret,
+					NULL, NULL, 0) : NULL;
+		return ret;
+	}
 	/* FIXME provide the actual AppServerClient */
-	ret = appinterface_call_variablev(appserver->interface, appserver->app,
-			NULL, result, method, 0, NULL);
-	if(result != NULL)
-		variable_delete(result);
-	return ret;
+	return appinterface_call_message(appserver->interface, appserver->app,
+			NULL, message, reply);
+}
+
+
+/* calls */
+/* appserver_call_delete */
+static void _appserver_call_delete(AppServerCall * call)
+{
+	/* only from the event loop of the call */
+	if(call->reply != NULL)
+		appmessage_delete(call->reply);
+	appmessage_delete(call->message);
+	apptransport_client_unref(call->client);
+	free(call);
+}
+
+
+/* appserver_calls_start */
+static void * _calls_start_thread(void * data);
+static AppServerCall * _calls_start_thread_next(AppServer * appserver);
+static void _calls_start_thread_run(AppServer * appserver,
+		AppServerCall * call);
+
+static int _appserver_calls_start(AppServer * appserver)
+{
+	size_t cnt = ASO_THREADS_COUNT(appserver->options);
+	AppServerThread * thread;
+	int res;
+
+	if(cnt == 0)
+		return 0;
+	if((appserver->threads = malloc(sizeof(*thread) * cnt)) == NULL)
+		return -error_set_code(-errno, "%s", strerror(errno));
+	for(; appserver->threads_cnt < cnt; appserver->threads_cnt++)
+	{
+		thread = &appserver->threads[appserver->threads_cnt];
+		thread->appserver = appserver;
+		thread->client = NULL;
+		if((res = pthread_create(&thread->thread, NULL,
+						_calls_start_thread, thread))
+				!= 0)
+			return -error_set_code(-res, "%s", strerror(res));
+	}
+	return 0;
+}
+
+static void * _calls_start_thread(void * data)
+{
+	AppServerThread * thread = data;
+	AppServer * appserver = thread->appserver;
+	AppServerCall * call;
+
+	pthread_mutex_lock(&appserver->mutex);
+	while(appserver->calls_quit == 0)
+	{
+		if((call = _calls_start_thread_next(appserver)) == NULL)
+		{
+			pthread_cond_wait(&appserver->cond, &appserver->mutex);
+			continue;
+		}
+		thread->client = call->client;
+		pthread_mutex_unlock(&appserver->mutex);
+		_calls_start_thread_run(appserver, call);
+		pthread_mutex_lock(&appserver->mutex);
+		thread->client = NULL;
+		/* the client is available again (for ordered calls) */
+		pthread_cond_broadcast(&appserver->cond);
+	}
+	pthread_mutex_unlock(&appserver->mutex);
+	return NULL;
+}
+
+static AppServerCall * _calls_start_thread_next(AppServer * appserver)
+{
+	AppServerCall ** p;
+	AppServerCall * call;
+	size_t i;
+
+	for(p = &appserver->calls; (call = *p) != NULL; p = &call->next)
+	{
+		if((appserver->options & ASO_ORDERED) == 0)
+			break;
+		/* skip the clients currently served */
+		for(i = 0; i < appserver->threads_cnt; i++)
+			if(appserver->threads[i].client == call->client)
+				break;
+		if(i == appserver->threads_cnt)
+			break;
+	}
+	if(call == NULL)
+		return NULL;
+	if((*p = call->next) == NULL)
+		appserver->calls_last = p;
+	appserver->calls_cnt--;
+	call->next = NULL;
+	return call;
+}
+
+static void _calls_start_thread_run(AppServer * appserver,
+		AppServerCall * call)
+{
+	AppServerQueue * queue = call->queue;
+	AppServerCall * head = NULL;
+	AppServerCall * p;
+	size_t i;
+	AppMessage * reply;
+	const char c = '\0';
+
+	if(appmessage_get_type(call->message) == AMT_BATCH)
+	{
+		/* dispatch the calls of batches in order */
+		for(i = 0; i < call->allowed_cnt; i++)
+		{
+			/* XXX check for errors? */
+			_appserver_call(appserver,
+					appmessage_get_batch_message(
+						call->message, i),
+					call->allowed[i], &reply);
+			/* acknowledged once for the whole batch */
+			if(reply != NULL)
+				appmessage_delete(reply);
+		}
+	}
+	else
+		/* XXX check for errors? */
+		_appserver_call(appserver, call->message, call->allowed[0],
+				&call->reply);
+	/* post the call back to its event loop */
+	for(;;)
+	{
+		call->next = head;
+		if((p = __sync_val_compare_and_swap(&queue->done, head, call))
+				== head)
+			break;
+		head = p;
+	}
+	/* wake the event loop up if it was idle (the call is gone) */
+	if(head == NULL && write(queue->pipe[1], &c, sizeof(c)) != sizeof(c))
+		/* XXX report errors */
+		return;
+}
+
+
+/* appserver_calls_stop */
+static void _appserver_calls_stop(AppServer * appserver)
+{
+	size_t i;
+	AppServerCall * call;
+
+	pthread_mutex_lock(&appserver->mutex);
+	appserver->calls_quit = 1;
+	pthread_cond_broadcast(&appserver->cond);
+	pthread_mutex_unlock(&appserver->mutex);
+	for(i = 0; i < appserver->threads_cnt; i++)
+		pthread_join(appserver->threads[i].thread, NULL);
+	free(appserver->threads);
+	appserver->threads = NULL;
+	appserver->threads_cnt = 0;
+	/* discard the calls not handled */
+	while((call = appserver->calls) != NULL)
+	{
+		appserver->calls = call->next;
+		_appserver_call_delete(call);
+	}
+	appserver->calls_last = &appserver->calls;
+	appserver->calls_cnt = 0;
+}
+
+
+/* queues */
+/* appserver_queue_init */
+static int _queue_init_callback(int fd, AppServerQueue * queue);
+
+static int _appserver_queue_init(AppServerQueue * queue, Event * event,
+		AppTransport * transport)
+{
+	queue->transport = transport;
+	queue->done = NULL;
+	if(pipe(queue->pipe) != 0)
+	{
+		queue->pipe[0] = -1;
+		queue->pipe[1] = -1;
+		return -error_set_code(-errno, "%s", strerror(errno));
+	}
+	event_register_io_read(event, queue->pipe[0],
+			(EventIOFunc)_queue_init_callback, queue);
+	return 0;
+}
+
+static int _queue_init_callback(int fd, AppServerQueue * queue)
+{
+	char c;
+	AppServerCall * call;
+	AppServerCall * calls = NULL;
+	AppServerCall * next;
+
+	if(read(fd, &c, sizeof(c)) != sizeof(c))
+		return 0;
+	/* take every call completed so far */
+	call = __sync_lock_test_and_set(&queue->done, NULL);
+	/* restore the order of completion */
+	for(; call != NULL; call = next)
+	{
+		next = call->next;
+		call->next = calls;
+		calls = call;
+	}
+	for(call = calls; call != NULL; call = next)
+	{
+		next = call->next;
+		/* XXX we can ignore errors */
+		apptransport_server_reply(queue->transport, call->client,
+				call->message, call->reply);
+		_appserver_call_delete(call);
+	}
+	return 0;
+}
+
+
+/* appserver_queue_destroy */
+static void _appserver_queue_destroy(AppServerQueue * queue, Event * event)
+{
+	AppServerCall * call;
+
+	if(queue->pipe[0] < 0)
+		return;
+	event_unregister_io_read(event, queue->pipe[0]);
+	/* discard the calls not acknowledged */
+	while((call = queue->done) != NULL)
+	{
+		queue->done = call->next;
+		_appserver_call_delete(call);
+	}
+	close(queue->pipe[0]);
+	close(queue->pipe[1]);
+	queue->pipe[0] = -1;
+	queue->pipe[1] = -1;
+}
+
+
+/* workers */
+/* appserver_workers_start */
+static int _workers_start_callback(int fd, AppServerWorker * worker);
+static void * _workers_start_thread(void * data);
+
+static int _appserver_workers_start(AppServer * appserver)
+{
+	size_t i;
+	AppServerWorker * worker;
+	int res;
+
+	for(i = 0; i < appserver->workers_cnt; i++)
+	{
+		worker = &appserver->workers[i];
+		if(worker->running)
+			continue;
+		/* the pipe may have been closed to stop the worker */
+		if(worker->pipe[1] < 0)
+		{
+			close(worker->pipe[0]);
+			worker->pipe[0] = -1;
+			if(pipe(worker->pipe) != 0)
+				return -error_set_code(-errno, "%s",
+						strerror(errno));
+		}
+		event_register_io_read(worker->event, worker->pipe[0],
+				(EventIOFunc)_workers_start_callback, worker);
+		if((res = pthread_create(&worker->thread, NULL,
+						_workers_start_thread, worker))
+				!= 0)
+		{
+			event_unregister_io_read(worker->event,
+					worker->pipe[0]);
+			return -error_set_code(-res, "%s", strerror(res));
+		}
+		worker->running = 1;
+	}
+	return 0;
+}
+
+static int _workers_start_callback(int fd, AppServerWorker * worker)
+{
+	char c;
+
+	/* the worker was asked to stop (or the pipe was closed) */
+	if(read(fd, &c, sizeof(c)) < 0 && (errno == EINTR || errno == EAGAIN))
+		return 0;
+	event_loop_quit(worker->event);
+	/* unregister this callback */
+	return 1;
+}
+
+static void * _workers_start_thread(void * data)
+{
+	AppServerWorker * worker = data;
+
+	event_loop(worker->event);
+	return NULL;
+}
+
+
+/* appserver_workers_stop */
+static void _appserver_workers_stop(AppServer * appserver)
+{
+	size_t i;
+	AppServerWorker * worker;
+	const char c = '\0';
+	ssize_t res;
+
+	for(i = 0; i < appserver->workers_cnt; i++)
+	{
+		worker = &appserver->workers[i];
+		if(!worker->running)
+			continue;
+		while((res = write(worker->pipe[1], &c, sizeof(c))) < 0
+				&& (errno == EINTR || errno == EAGAIN));
+		if(res != sizeof(c))
+		{
+			/* the worker stops on EOF instead */
+			close(worker->pipe[1]);
+			worker->pipe[1] = -1;
+		}
+		/* the worker may still refer to the server */
+		pthread_join(worker->thread, NULL);
+		worker->running = 0;
+	}
 }
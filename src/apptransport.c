@@ -15,11 +15,22 @@
 
 
 
+#include <sys/time.h>
 #include <stdlib.h>
 #ifdef DEBUG
 # include <stdio.h>
 #endif
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <errno.h>
+#ifdef __WIN32__
+# include <Winsock2.h>
+# include <Ws2tcpip.h>
+#else
+# include <sys/socket.h>
+# include <netdb.h>
+#endif
 #include <System.h>
 #include "App/appclient.h"
 #include "appmessage.h"
@@ -40,6 +51,8 @@
 /* AppTransport */
 /* private */
 /* types */
+typedef struct _AppTransportTimer AppTransportTimer;
+
 struct _AppTransport
 {
 	AppTransportMode mode;
@@ -57,17 +70,79 @@ struct _AppTransport
 
 	/* acknowledgements */
 	AppMessageID id;
+	/* clients with acknowledgements pending (servers) */
+	AppTransportClient * acks;
+	AppTransportTimer * acks_timer;
+
+	/* advertised to the clients */
+	AppMessage * handshake;
 };
 
 struct _AppTransportClient
 {
+	unsigned int refcount;
 	AppTransport * transport;
 	String * name;
+	int resolved;
+	/* legacy clients only understand plain acknowledgements */
+	int announced;
+	int handshake;
+
+	/* for the transport plug-in */
+	void * data;
+
+	/* access verdicts cached per call (0: unknown) */
+	signed char * verdicts;
+	size_t verdicts_cnt;
+
+	/* acknowledgements pending (ranges of IDs, first and last) */
+	AppMessageID * acks;
+	size_t acks_cnt;
+	size_t acks_alloc;
+	int acks_queued;
+	AppTransportClient * acks_next;
+};
+
+/* timeouts (they may outlive their transport, as the Event can be shared) */
+struct _AppTransportTimer
+{
+	AppTransport * transport;
 };
 
 
+/* constants */
+#ifndef APPTRANSPORT_ACK_DELAY
+# define APPTRANSPORT_ACK_DELAY	1
+#endif
+#define APPTRANSPORT_ACK_RANGES	64
+
+#define LOOKUP_CACHE		32
+#define LOOKUP_TTL		60
+#define LOOKUP_TTL_NEGATIVE	10
+
+
+/* variables */
+/* addresses resolved (shared by every transport in the process) */
+static struct
+{
+	String * hostname;
+	String * servname;
+	int family;
+	int socktype;
+	int protocol;
+	int flags;
+
+	time_t expires;
+	int res;
+	struct addrinfo * ai;
+} _apptransport_lookup[LOOKUP_CACHE];
+static pthread_mutex_t _apptransport_lookup_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
 /* prototypes */
 /* helpers */
+static int _apptransport_helper_receive(AppTransport * transport,
+		AppMessage * message);
 static int _apptransport_helper_status(AppTransport * transport,
 		AppTransportStatus status, unsigned int code,
 		char const * message);
@@ -79,6 +154,26 @@ static void _apptransport_helper_client_delete(AppTransport * transport,
 
 static int _apptransport_helper_client_receive(AppTransport * transport,
 		AppTransportClient * client, AppMessage * message);
+static void * _apptransport_helper_client_get_data(AppTransport * transport,
+		AppTransportClient * client);
+static void _apptransport_helper_client_set_data(AppTransport * transport,
+		AppTransportClient * client, void * data);
+
+static int _apptransport_helper_lookup(AppTransport * transport,
+		char const * hostname, char const * servname,
+		struct addrinfo const * hints, struct addrinfo ** res);
+static void _apptransport_helper_lookup_free(AppTransport * transport,
+		struct addrinfo * ai);
+
+/* useful */
+static int _apptransport_server_acknowledge(AppTransport * transport,
+		AppTransportClient * client, AppMessageID id);
+static int _apptransport_server_flush(AppTransport * transport,
+		AppTransportClient * client);
+static void _apptransport_server_flush_all(AppTransport * transport);
+
+/* callbacks */
+static int _apptransport_on_acknowledge(void * data);
 
 
 /* protected */
@@ -188,6 +283,7 @@ static String * _new_app_transport(String ** name)
 
 
 /* apptransport_new_plugin */
+static int _new_plugin_announce(AppTransport * apptransport);
 static void _new_plugin_helper(AppTransport * apptransport,
 		AppTransportMode mode, Event * event);
 
@@ -239,26 +335,55 @@ AppTransport * apptransport_new_plugin(AppTransportMode mode,
 		apptransport_delete(apptransport);
 		return NULL;
 	}
+	if(mode == ATM_CLIENT)
+		/* XXX we can ignore errors */
+		_new_plugin_announce(apptransport);
 	return apptransport;
 }
 
+static int _new_plugin_announce(AppTransport * apptransport)
+{
+	int ret;
+	AppMessage * message;
+
+	/* an empty acknowledgement is ignored by legacy servers */
+	if((message = appmessage_new_acknowledgement(0)) == NULL)
+		return -1;
+	ret = apptransport_client_queue(apptransport, message, 0);
+	appmessage_delete(message);
+	return ret;
+}
+
 static void _new_plugin_helper(AppTransport * apptransport,
 		AppTransportMode mode, Event * event)
 {
 	apptransport->thelper.transport = apptransport;
 	apptransport->thelper.event = event;
+	apptransport->thelper.receive = _apptransport_helper_receive;
 	apptransport->thelper.status = _apptransport_helper_status;
 	apptransport->thelper.client_new = _apptransport_helper_client_new;
 	apptransport->thelper.client_delete
 		= _apptransport_helper_client_delete;
 	apptransport->thelper.client_receive
 		= _apptransport_helper_client_receive;
+	apptransport->thelper.client_get_data
+		= _apptransport_helper_client_get_data;
+	apptransport->thelper.client_set_data
+		= _apptransport_helper_client_set_data;
+	apptransport->thelper.lookup = _apptransport_helper_lookup;
+	apptransport->thelper.lookup_free = _apptransport_helper_lookup_free;
+	apptransport->thelper.flags = apptransport->helper.flags;
 }
 
 
 /* apptransport_delete */
 void apptransport_delete(AppTransport * transport)
 {
+	/* send the acknowledgements still pending */
+	if(transport->acks_timer != NULL)
+		/* let the timeout expire on its own */
+		transport->acks_timer->transport = NULL;
+	_apptransport_server_flush_all(transport);
 	if(transport->appclient != NULL)
 		appclient_delete(transport->appclient);
 	if(transport->tplugin != NULL)
@@ -267,6 +392,8 @@ void apptransport_delete(AppTransport * transport)
 		plugin_delete(transport->plugin);
 	if(transport->name != NULL)
 		string_delete(transport->name);
+	if(transport->handshake != NULL)
+		appmessage_delete(transport->handshake);
 	object_delete(transport);
 }
 
@@ -296,11 +423,82 @@ String const * apptransport_get_transport(AppTransport * transport)
 /* apptransport_client_get_name */
 String const * apptransport_client_get_name(AppTransportClient * client)
 {
+	AppTransport * transport = client->transport;
+	char name[256];
+	String * p;
+
+	/* the name is only resolved once it is actually needed */
+	if(client->resolved == 0)
+	{
+		client->resolved = 1;
+		if(transport->definition->server_get_client_name != NULL
+				&& transport->definition->server_get_client_name(
+					transport->tplugin, client, name,
+					sizeof(name)) == 0
+				&& (p = string_new(name)) != NULL)
+		{
+			if(client->name != NULL)
+				string_delete(client->name);
+			client->name = p;
+		}
+	}
 	return client->name;
 }
 
 
+/* apptransport_client_get_verdict */
+int apptransport_client_get_verdict(AppTransportClient * client, size_t index)
+{
+	if(index >= client->verdicts_cnt || client->verdicts[index] == 0)
+		return -1;
+	return (client->verdicts[index] > 0) ? 1 : 0;
+}
+
+
+/* apptransport_client_set_verdict */
+int apptransport_client_set_verdict(AppTransportClient * client, size_t index,
+		int verdict)
+{
+	signed char * p;
+
+	if(index >= client->verdicts_cnt)
+	{
+		if((p = realloc(client->verdicts, sizeof(*p) * (index + 1)))
+				== NULL)
+			return -error_set_code(-errno, "%s", strerror(errno));
+		memset(&p[client->verdicts_cnt], 0, sizeof(*p)
+				* (index + 1 - client->verdicts_cnt));
+		client->verdicts = p;
+		client->verdicts_cnt = index + 1;
+	}
+	client->verdicts[index] = (verdict != 0) ? 1 : -1;
+	return 0;
+}
+
+
 /* useful */
+/* apptransport_client_ref */
+AppTransportClient * apptransport_client_ref(AppTransportClient * client)
+{
+	if(client != NULL)
+		client->refcount++;
+	return client;
+}
+
+
+/* apptransport_client_unref */
+void apptransport_client_unref(AppTransportClient * client)
+{
+	if(client == NULL || --client->refcount > 0)
+		return;
+	free(client->verdicts);
+	free(client->acks);
+	if(client->name != NULL)
+		string_delete(client->name);
+	object_delete(client);
+}
+
+
 /* apptransport_lookup */
 String * apptransport_lookup(char const * app)
 {
@@ -329,18 +527,78 @@ String * apptransport_lookup(char const * app)
 }
 
 
-/* apptransport_client_send */
-int apptransport_client_send(AppTransport * transport, AppMessage * message,
+/* apptransport_client_set_id */
+void apptransport_client_set_id(AppTransport * transport, AppMessage * message,
 		int acknowledge)
 {
+	/* the ID may have been assigned before sending */
 	if(transport->mode == ATM_CLIENT
-			&& appmessage_get_type(message) == AMT_CALL
-			&& acknowledge != 0)
-		/* FIXME will wrap around after 2^32-1 acknowledgements */
+			&& (appmessage_get_type(message) == AMT_CALL
+				|| appmessage_get_type(message) == AMT_BATCH)
+			&& acknowledge != 0 && appmessage_get_id(message) == 0)
+		/* 64-bit IDs (0 is reserved) */
 		appmessage_set_id(message, ++transport->id);
+}
+
+
+/* apptransport_client_queue */
+int apptransport_client_queue(AppTransport * transport, AppMessage * message,
+		int acknowledge)
+{
+	apptransport_client_set_id(transport, message, acknowledge);
+	/* sending may not block for some transports */
+	if(transport->definition->client_queue != NULL)
+		return transport->definition->client_queue(transport->tplugin,
+				message);
+	if(transport->definition->client_send == NULL)
+		return -error_set_code(1, "%s",
+				"This transport does not support calls");
 	return transport->definition->client_send(transport->tplugin, message);
 }
 
+/* apptransport_client_send */
+int apptransport_client_send(AppTransport * transport, AppMessage * message,
+		int acknowledge)
+{
+	apptransport_client_set_id(transport, message, acknowledge);
+	return transport->definition->client_send(transport->tplugin, message);
+}
+
+
+/* apptransport_server_acknowledge */
+int apptransport_server_acknowledge(AppTransport * transport,
+		AppTransportClient * client, AppMessage * message)
+{
+	AppMessageID id;
+
+	/* check if an acknowledgement is requested */
+	if((id = appmessage_get_id(message)) == 0)
+		return 0;
+	return _apptransport_server_acknowledge(transport, client, id);
+}
+
+
+/* apptransport_server_reply */
+int apptransport_server_reply(AppTransport * transport,
+		AppTransportClient * client, AppMessage * message,
+		AppMessage * reply)
+{
+	AppMessageID id;
+
+	/* check if a reply is expected */
+	if((id = appmessage_get_id(message)) == 0)
+		return 0;
+	/* empty replies are acknowledgements (coalesced), and legacy clients
+	 * only understand acknowledgements */
+	if(reply == NULL || client == NULL || client->announced == 0
+			|| (appmessage_get_reply_code(reply) == 0
+				&& appmessage_get_reply_result(reply) == NULL
+				&& appmessage_get_arguments_count(reply) == 0))
+		return _apptransport_server_acknowledge(transport, client, id);
+	appmessage_set_id(reply, id);
+	return apptransport_server_send(transport, client, reply);
+}
+
 
 /* apptransport_server_register */
 int apptransport_server_register(AppTransport * transport, char const * app,
@@ -364,24 +622,72 @@ int apptransport_server_register(AppTransport * transport, char const * app,
 }
 
 
+/* apptransport_server_set_handshake */
+int apptransport_server_set_handshake(AppTransport * transport,
+		AppMessage * message)
+{
+	if(transport->mode != ATM_SERVER)
+		return -error_set_code(1, "%s",
+				"Only servers can advertise their methods");
+	if(transport->handshake != NULL)
+		appmessage_delete(transport->handshake);
+	transport->handshake = message;
+	return 0;
+}
+
+
 /* apptransport_server_send */
 int apptransport_server_send(AppTransport * transport,
 		AppTransportClient * client, AppMessage * message)
 {
+	int ret;
+	int acks = 0;
+
 	if(transport->mode != ATM_SERVER)
 		return -error_set_code(1, "%s",
 				"Only servers can reply to clients");
 	if(transport->definition->server_send == NULL)
 		return -error_set_code(1, "%s",
 				"This transport does not support replies");
-	return transport->definition->server_send(transport->tplugin, client,
+	/* piggyback the acknowledgements pending for this client */
+	if(client != NULL && client->acks_cnt > 0
+			&& appmessage_set_acknowledgements(message,
+				client->acks, client->acks_cnt) == 0)
+	{
+		client->acks_cnt = 0;
+		acks = 1;
+	}
+	ret = transport->definition->server_send(transport->tplugin, client,
 			message);
+	/* the message may be sent again (eg handshakes) */
+	if(acks)
+		appmessage_set_acknowledgements(message, NULL, 0);
+	return ret;
 }
 
 
 /* private */
 /* functions */
 /* helpers */
+/* apptransport_helper_receive */
+static int _apptransport_helper_receive(AppTransport * transport,
+		AppMessage * message)
+{
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s() %u %llu\n", __func__,
+			appmessage_get_type(message),
+			(unsigned long long)appmessage_get_id(message));
+#endif
+	if(transport->mode != ATM_CLIENT)
+		/* XXX improve the error message */
+		return -error_set_code(1, "Not a client");
+	if(transport->helper.message == NULL)
+		return 0;
+	return transport->helper.message(transport->helper.data, transport,
+			NULL, message);
+}
+
+
 /* apptransport_helper_status */
 static int _apptransport_helper_status(AppTransport * transport,
 		AppTransportStatus status, unsigned int code,
@@ -407,6 +713,7 @@ static AppTransportClient * _apptransport_helper_client_new(
 #endif
 	if((client = object_new(sizeof(*client))) == NULL)
 		return NULL;
+	client->refcount = 1;
 	client->transport = transport;
 	if(name != NULL)
 	{
@@ -418,6 +725,17 @@ static AppTransportClient * _apptransport_helper_client_new(
 	}
 	else
 		client->name = NULL;
+	client->resolved = 0;
+	client->announced = 0;
+	client->handshake = 0;
+	client->data = NULL;
+	client->verdicts = NULL;
+	client->verdicts_cnt = 0;
+	client->acks = NULL;
+	client->acks_cnt = 0;
+	client->acks_alloc = 0;
+	client->acks_queued = 0;
+	client->acks_next = NULL;
 	return client;
 }
 
@@ -429,7 +747,13 @@ static void _apptransport_helper_client_delete(AppTransport * transport,
 #ifdef DEBUG
 	fprintf(stderr, "DEBUG: %s()\n", __func__);
 #endif
-	object_delete(client);
+	if(client == NULL)
+		return;
+	/* the client may still be referenced by pending calls */
+	client->data = NULL;
+	/* the acknowledgements can no longer be sent */
+	client->acks_cnt = 0;
+	apptransport_client_unref(client);
 }
 
 
@@ -437,27 +761,342 @@ static void _apptransport_helper_client_delete(AppTransport * transport,
 static int _apptransport_helper_client_receive(AppTransport * transport,
 		AppTransportClient * client, AppMessage * message)
 {
-	AppMessageID id;
+	size_t i;
+	size_t cnt;
 
 #ifdef DEBUG
-	fprintf(stderr, "DEBUG: %s() %u %u \"%s\"\n", __func__,
+	fprintf(stderr, "DEBUG: %s() %u %llu \"%s\"\n", __func__,
 			appmessage_get_type(message),
-			appmessage_get_id(message),
+			(unsigned long long)appmessage_get_id(message),
 			appmessage_get_method(message));
 #endif
 	if(transport->mode != ATM_SERVER)
 		/* XXX improve the error message */
 		return -error_set_code(1, "Not a server");
-	/* XXX check for errors? */
-	transport->helper.message(transport->helper.data, transport, client,
-			message);
-	/* check if an acknowledgement is requested */
-	if((id = appmessage_get_id(message)) != 0)
-		/* XXX we can ignore errors */
-		if((message = appmessage_new_acknowledgement(id)) != NULL)
+	/* clients announce themselves with an empty acknowledgement */
+	if(appmessage_get_type(message) == AMT_ACKNOWLEDGEMENT
+			&& appmessage_get_id(message) == 0 && client != NULL)
+		client->announced = 1;
+	/* advertise the method IDs along with the first reply */
+	if(transport->handshake != NULL && client != NULL
+			&& client->announced != 0 && client->handshake == 0
+			/* XXX we can ignore errors */
+			&& apptransport_server_send(transport, client,
+				transport->handshake) == 0)
+		client->handshake = 1;
+	/* there is nothing else to do with acknowledgements */
+	if(appmessage_get_type(message) == AMT_ACKNOWLEDGEMENT)
+		return 0;
+	/* the messages may be handled asynchronously */
+	if(transport->helper.dispatch != NULL
+			&& transport->helper.dispatch(transport->helper.data,
+				transport, client, message) == 0)
+		return 0;
+	/* the helper replies to the calls */
+	if(appmessage_get_type(message) != AMT_BATCH)
+	{
+		/* XXX check for errors? */
+		transport->helper.message(transport->helper.data, transport,
+				client, message);
+		return 0;
+	}
+	/* dispatch the calls of batches in order */
+	cnt = appmessage_get_batch_messages_count(message);
+	for(i = 0; i < cnt; i++)
+		/* XXX check for errors? */
+		transport->helper.message(transport->helper.data, transport,
+				client, appmessage_get_batch_message(message,
+					i));
+	/* acknowledge once per batch */
+	/* XXX we can ignore errors */
+	apptransport_server_acknowledge(transport, client, message);
+	return 0;
+}
+
+
+/* apptransport_helper_client_get_data */
+static void * _apptransport_helper_client_get_data(AppTransport * transport,
+		AppTransportClient * client)
+{
+	if(client->transport != transport)
+		return NULL;
+	return client->data;
+}
+
+
+/* apptransport_helper_client_set_data */
+static void _apptransport_helper_client_set_data(AppTransport * transport,
+		AppTransportClient * client, void * data)
+{
+	client->data = data;
+}
+
+
+/* apptransport_helper_lookup */
+static int _lookup_compare(char const * a, char const * b);
+static struct addrinfo * _lookup_copy(struct addrinfo const * ai);
+static int _lookup_set(String ** p, char const * s);
+
+static int _apptransport_helper_lookup(AppTransport * transport,
+		char const * hostname, char const * servname,
+		struct addrinfo const * hints, struct addrinfo ** res)
+{
+	int ret;
+	time_t now = time(NULL);
+	size_t i;
+	size_t j = 0;
+
+	/* the transports of the server workers may be created concurrently */
+	pthread_mutex_lock(&_apptransport_lookup_mutex);
+	for(i = 0; i < LOOKUP_CACHE; i++)
+	{
+		if(_apptransport_lookup[i].expires
+				< _apptransport_lookup[j].expires)
+			/* replace the oldest entry if necessary */
+			j = i;
+		if(_apptransport_lookup[i].expires <= now
+				|| _apptransport_lookup[i].family
+				!= hints->ai_family
+				|| _apptransport_lookup[i].socktype
+				!= hints->ai_socktype
+				|| _apptransport_lookup[i].protocol
+				!= hints->ai_protocol
+				|| _apptransport_lookup[i].flags
+				!= hints->ai_flags
+				|| _lookup_compare(
+					_apptransport_lookup[i].hostname,
+					hostname) != 0
+				|| _lookup_compare(
+					_apptransport_lookup[i].servname,
+					servname) != 0)
+			continue;
+#ifdef DEBUG
+		fprintf(stderr, "DEBUG: %s(\"%s\", \"%s\") cached\n", __func__,
+				hostname, servname);
+#endif
+		break;
+	}
+	if(i == LOOKUP_CACHE)
+	{
+		/* resolve the address (and remember failures as well) */
+		i = j;
+		if(_apptransport_lookup[i].ai != NULL)
+			freeaddrinfo(_apptransport_lookup[i].ai);
+		_apptransport_lookup[i].ai = NULL;
+		_apptransport_lookup[i].expires = 0;
+		if(_lookup_set(&_apptransport_lookup[i].hostname, hostname)
+				!= 0
+				|| _lookup_set(&_apptransport_lookup[i].servname,
+					servname) != 0)
 		{
-			apptransport_server_send(transport, client, message);
-			appmessage_delete(message);
+			pthread_mutex_unlock(&_apptransport_lookup_mutex);
+			return EAI_MEMORY;
 		}
+		_apptransport_lookup[i].family = hints->ai_family;
+		_apptransport_lookup[i].socktype = hints->ai_socktype;
+		_apptransport_lookup[i].protocol = hints->ai_protocol;
+		_apptransport_lookup[i].flags = hints->ai_flags;
+		_apptransport_lookup[i].res = getaddrinfo(hostname, servname,
+				hints, &_apptransport_lookup[i].ai);
+		_apptransport_lookup[i].expires = now
+			+ ((_apptransport_lookup[i].res == 0)
+					? LOOKUP_TTL : LOOKUP_TTL_NEGATIVE);
+	}
+	if((ret = _apptransport_lookup[i].res) == 0
+			/* the caller owns a copy of the result */
+			&& (*res = _lookup_copy(_apptransport_lookup[i].ai))
+			== NULL)
+		ret = EAI_MEMORY;
+	pthread_mutex_unlock(&_apptransport_lookup_mutex);
+	return ret;
+}
+
+static int _lookup_compare(char const * a, char const * b)
+{
+	if(a == NULL || b == NULL)
+		return (a == b) ? 0 : 1;
+	return strcmp(a, b);
+}
+
+static struct addrinfo * _lookup_copy(struct addrinfo const * ai)
+{
+	struct addrinfo * ret = NULL;
+	struct addrinfo ** p = &ret;
+	size_t size;
+	char * q;
+
+	for(; ai != NULL; ai = ai->ai_next)
+	{
+		/* each entry is allocated at once */
+		size = sizeof(*ai) + ai->ai_addrlen;
+		if(ai->ai_canonname != NULL)
+			size += strlen(ai->ai_canonname) + 1;
+		if((*p = malloc(size)) == NULL)
+		{
+			_apptransport_helper_lookup_free(NULL, ret);
+			return NULL;
+		}
+		memcpy(*p, ai, sizeof(*ai));
+		q = (char *)(*p + 1);
+		(*p)->ai_addr = (struct sockaddr *)q;
+		memcpy(q, ai->ai_addr, ai->ai_addrlen);
+		if(ai->ai_canonname != NULL)
+		{
+			(*p)->ai_canonname = q + ai->ai_addrlen;
+			strcpy((*p)->ai_canonname, ai->ai_canonname);
+		}
+		(*p)->ai_next = NULL;
+		p = &(*p)->ai_next;
+	}
+	return ret;
+}
+
+static int _lookup_set(String ** p, char const * s)
+{
+	String * q = NULL;
+
+	if(s != NULL && (q = string_new(s)) == NULL)
+		return -1;
+	if(*p != NULL)
+		string_delete(*p);
+	*p = q;
 	return 0;
 }
+
+
+/* apptransport_helper_lookup_free */
+static void _apptransport_helper_lookup_free(AppTransport * transport,
+		struct addrinfo * ai)
+{
+	struct addrinfo * p;
+
+	for(; ai != NULL; ai = p)
+	{
+		p = ai->ai_next;
+		free(ai);
+	}
+}
+
+
+/* useful */
+/* apptransport_server_acknowledge */
+static int _apptransport_server_acknowledge(AppTransport * transport,
+		AppTransportClient * client, AppMessageID id)
+{
+	int ret;
+	AppMessage * message;
+	AppMessageID * p;
+	size_t alloc;
+	AppTransportTimer * timer;
+	struct timeval tv;
+
+	if(client == NULL || client->announced == 0)
+	{
+		/* acknowledge immediately (and separately) */
+		if((message = appmessage_new_acknowledgement(id)) == NULL)
+			return -1;
+		ret = apptransport_server_send(transport, client, message);
+		appmessage_delete(message);
+		return ret;
+	}
+	if(client->acks_cnt > 0 && client->acks[client->acks_cnt * 2 - 1] + 1
+			== id)
+		/* extend the last range */
+		client->acks[client->acks_cnt * 2 - 1] = id;
+	else
+	{
+		if(client->acks_cnt == client->acks_alloc)
+		{
+			alloc = (client->acks_alloc > 0)
+				? client->acks_alloc * 2 : 4;
+			if((p = realloc(client->acks, sizeof(*p) * alloc * 2))
+					== NULL)
+				return -error_set_code(-errno, "%s",
+						strerror(errno));
+			client->acks = p;
+			client->acks_alloc = alloc;
+		}
+		client->acks[client->acks_cnt * 2] = id;
+		client->acks[client->acks_cnt * 2 + 1] = id;
+		client->acks_cnt++;
+	}
+	/* do not let the ranges accumulate */
+	if(client->acks_cnt >= APPTRANSPORT_ACK_RANGES)
+		return _apptransport_server_flush(transport, client);
+	if(client->acks_queued == 0)
+	{
+		client->acks_next = transport->acks;
+		transport->acks = apptransport_client_ref(client);
+		client->acks_queued = 1;
+	}
+	if(transport->acks_timer != NULL)
+		return 0;
+	/* send the acknowledgements once the flush window is over */
+	if((timer = object_new(sizeof(*timer))) == NULL)
+		return _apptransport_server_flush(transport, client);
+	timer->transport = transport;
+	tv.tv_sec = APPTRANSPORT_ACK_DELAY / 1000;
+	tv.tv_usec = (APPTRANSPORT_ACK_DELAY % 1000) * 1000;
+	if(event_register_timeout(transport->thelper.event, &tv,
+				_apptransport_on_acknowledge, timer) != 0)
+	{
+		object_delete(timer);
+		return _apptransport_server_flush(transport, client);
+	}
+	transport->acks_timer = timer;
+	return 0;
+}
+
+
+/* apptransport_server_flush */
+static int _apptransport_server_flush(AppTransport * transport,
+		AppTransportClient * client)
+{
+	int ret;
+	AppMessage * message;
+
+	if(client->acks_cnt == 0)
+		return 0;
+	/* the acknowledgements are carried by an empty acknowledgement */
+	if((message = appmessage_new_acknowledgement(0)) == NULL)
+		return -1;
+	ret = apptransport_server_send(transport, client, message);
+	appmessage_delete(message);
+	return ret;
+}
+
+
+/* apptransport_server_flush_all */
+static void _apptransport_server_flush_all(AppTransport * transport)
+{
+	AppTransportClient * client;
+
+	while((client = transport->acks) != NULL)
+	{
+		transport->acks = client->acks_next;
+		client->acks_next = NULL;
+		client->acks_queued = 0;
+		/* XXX we can ignore errors */
+		_apptransport_server_flush(transport, client);
+		apptransport_client_unref(client);
+	}
+}
+
+
+/* callbacks */
+/* apptransport_on_acknowledge */
+static int _apptransport_on_acknowledge(void * data)
+{
+	AppTransportTimer * timer = data;
+	AppTransport * transport = timer->transport;
+
+	object_delete(timer);
+	/* the transport may have been deleted in the meantime */
+	if(transport != NULL)
+	{
+		transport->acks_timer = NULL;
+		_apptransport_server_flush_all(transport);
+	}
+	/* unregister the timeout */
+	return 1;
+}
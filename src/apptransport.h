@@ -31,6 +31,10 @@ typedef struct _AppTransportHelper
 	void * data;
 	int (*message)(void * data, AppTransport * transport,
 			AppTransportClient * client, AppMessage * message);
+	/* takes the messages of the clients over (returns 0) */
+	int (*dispatch)(void * data, AppTransport * transport,
+			AppTransportClient * client, AppMessage * message);
+	AppTransportFlags flags;
 } AppTransportHelper;
 
 
@@ -51,18 +55,36 @@ String const * apptransport_get_name(AppTransport * transport);
 String const * apptransport_get_transport(AppTransport * transport);
 
 String const * apptransport_client_get_name(AppTransportClient * client);
+int apptransport_client_get_verdict(AppTransportClient * client, size_t index);
+int apptransport_client_set_verdict(AppTransportClient * client, size_t index,
+		int verdict);
+
+AppTransportClient * apptransport_client_ref(AppTransportClient * client);
+void apptransport_client_unref(AppTransportClient * client);
 
 /* useful */
 String * apptransport_lookup(char const * app);
 
 /* ATM_CLIENT */
+void apptransport_client_set_id(AppTransport * transport, AppMessage * message,
+		int acknowledge);
+int apptransport_client_queue(AppTransport * transport, AppMessage * message,
+		int acknowledge);
 int apptransport_client_send(AppTransport * transport, AppMessage * message,
 		int acknowledge);
 
 /* ATM_SERVER */
+int apptransport_server_acknowledge(AppTransport * transport,
+		AppTransportClient * client, AppMessage * message);
 int apptransport_server_register(AppTransport * transport, char const * app,
 		char const * name);
+/* falls back to an acknowledgement if reply is NULL */
+int apptransport_server_reply(AppTransport * transport,
+		AppTransportClient * client, AppMessage * message,
+		AppMessage * reply);
 int apptransport_server_send(AppTransport * transport,
 		AppTransportClient * client, AppMessage * message);
+int apptransport_server_set_handshake(AppTransport * transport,
+		AppMessage * message);
 
 #endif /* !LIBAPP_APPTRANSPORT_H */
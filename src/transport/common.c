@@ -16,7 +16,8 @@
 
 
 /* init_address */
-static struct addrinfo * _init_address(char const * name, int domain, int flags)
+static struct addrinfo * _init_address(AppTransportPluginHelper * helper,
+		char const * name, int domain, int flags)
 {
 	struct addrinfo * ai = NULL;
 	char * hostname;
@@ -77,6 +78,7 @@ static struct addrinfo * _init_address(char const * name, int domain, int flags)
 			l = -error_set_code(-EINVAL, "%s", strerror(EINVAL));
 	}
 	/* FIXME perform this asynchronously */
+	/* the results are cached for the whole process */
 	memset(&hints, 0, sizeof(hints));
 	hints.ai_family = domain;
 	hints.ai_socktype = SOCK_STREAM;
@@ -86,15 +88,126 @@ static struct addrinfo * _init_address(char const * name, int domain, int flags)
 			hostname, servname, flags);
 #endif
 	if(l >= 0)
-		res = getaddrinfo(hostname, servname, &hints, &ai);
+		res = helper->lookup(helper->transport, hostname, servname,
+				&hints, &ai);
 	free(p);
 	/* check for errors */
 	if(res != 0)
 	{
 		error_set_code(res, "%s", gai_strerror(res));
-		if(ai != NULL)
-			freeaddrinfo(ai);
+		_destroy_address(helper, ai);
 		return NULL;
 	}
 	return ai;
 }
+
+
+/* destroy_address */
+static void _destroy_address(AppTransportPluginHelper * helper,
+		struct addrinfo * ai)
+{
+	if(ai != NULL)
+		helper->lookup_free(helper->transport, ai);
+}
+
+
+/* lookup_name */
+/* constants */
+#define LOOKUP_NAME_CACHE	64
+#define LOOKUP_NAME_TTL		300
+#define LOOKUP_NAME_TTL_NEGATIVE	60
+
+/* variables */
+/* reverse lookups cached by address */
+static struct
+{
+	struct sockaddr_storage sa;
+	socklen_t sa_len;
+	time_t expires;
+	int res;
+	char name[256];
+} _lookup_name_cache[LOOKUP_NAME_CACHE];
+/* shared by the worker threads of the servers */
+static pthread_mutex_t _lookup_name_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int _lookup_name(struct sockaddr const * sa, socklen_t sa_len,
+		int flags, char * name, size_t size)
+{
+	struct sockaddr_storage key;
+	unsigned char const * p = (unsigned char const *)&key;
+	uint32_t hash = 2166136261u;
+	socklen_t i;
+	time_t now = time(NULL);
+	size_t index;
+	int res;
+	char buf[sizeof(_lookup_name_cache[0].name)];
+
+	if(sa_len == 0 || sa_len > sizeof(key))
+		return -error_set_code(-EINVAL, "%s", strerror(EINVAL));
+	/* the cache is keyed by host (regardless of the port) */
+	memset(&key, 0, sizeof(key));
+	memcpy(&key, sa, sa_len);
+	if(key.ss_family == AF_INET)
+		((struct sockaddr_in *)&key)->sin_port = 0;
+	else if(key.ss_family == AF_INET6)
+		((struct sockaddr_in6 *)&key)->sin6_port = 0;
+	for(i = 0; i < sa_len; i++)
+		hash = (hash ^ p[i]) * 16777619u;
+	index = hash % LOOKUP_NAME_CACHE;
+	pthread_mutex_lock(&_lookup_name_mutex);
+	if(_lookup_name_cache[index].expires <= now
+			|| _lookup_name_cache[index].sa_len != sa_len
+			|| memcmp(&_lookup_name_cache[index].sa, &key, sa_len)
+			!= 0)
+	{
+		/* do not hold the lock while resolving */
+		pthread_mutex_unlock(&_lookup_name_mutex);
+		/* XXX may not be instant */
+		res = getnameinfo((struct sockaddr *)&key, sa_len, buf,
+				sizeof(buf), NULL, 0, NI_NAMEREQD | flags);
+		pthread_mutex_lock(&_lookup_name_mutex);
+		_lookup_name_cache[index].res = res;
+		if(res == 0)
+			memcpy(_lookup_name_cache[index].name, buf,
+					sizeof(buf));
+		memcpy(&_lookup_name_cache[index].sa, &key, sa_len);
+		_lookup_name_cache[index].sa_len = sa_len;
+		_lookup_name_cache[index].expires = now + ((res == 0)
+				? LOOKUP_NAME_TTL : LOOKUP_NAME_TTL_NEGATIVE);
+	}
+	else
+	{
+#ifdef DEBUG
+		fprintf(stderr, "DEBUG: %s() cached\n", __func__);
+#endif
+		if((res = _lookup_name_cache[index].res) == 0)
+			memcpy(buf, _lookup_name_cache[index].name,
+					sizeof(buf));
+	}
+	pthread_mutex_unlock(&_lookup_name_mutex);
+	if(res != 0)
+		return -error_set_code(1, "%s", gai_strerror(res));
+	snprintf(name, size, "%s", buf);
+	return 0;
+}
+
+
+/* share_socket */
+static int _share_socket(AppTransportPluginHelper * helper, int fd)
+{
+#ifdef SO_REUSEPORT
+	int opt = 1;
+
+	/* let the workers of a server listen on the same address */
+	if((helper->flags & ATF_SHARED) == 0)
+		return 0;
+	if(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) != 0)
+		return -error_set_code(-errno, "%s: %s", "setsockopt",
+				strerror(errno));
+	return 0;
+#else
+	if((helper->flags & ATF_SHARED) == 0)
+		return 0;
+	return -error_set_code(-ENOTSUP, "%s", strerror(ENOTSUP));
+#endif
+}
@@ -21,7 +21,14 @@
 
 /* private */
 /* functions */
-static struct addrinfo * _init_address(char const * name, int domain,
-		int flags);
+static struct addrinfo * _init_address(AppTransportPluginHelper * helper,
+		char const * name, int domain, int flags);
+static void _destroy_address(AppTransportPluginHelper * helper,
+		struct addrinfo * ai);
+
+static int _lookup_name(struct sockaddr const * sa, socklen_t sa_len,
+		int flags, char * name, size_t size);
+
+static int _share_socket(AppTransportPluginHelper * helper, int fd);
 
 #endif /* !APPTRANSPORT_TRANSPORT_COMMON_H */
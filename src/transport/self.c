@@ -54,6 +54,8 @@ AppTransportPluginDefinition transport =
 	_self_destroy,
 	/* FIXME implement the missing callbacks */
 	NULL,
+	NULL,
+	NULL,
 	NULL
 };
 
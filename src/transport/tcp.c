@@ -17,14 +17,18 @@
 
 
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+# define _GNU_SOURCE /* for accept4() */
+#endif
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
-#ifdef DEBUG
-# include <stdio.h>
-#endif
+#include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
 #include <limits.h>
 #include <errno.h>
 #ifdef __WIN32__
@@ -42,32 +46,82 @@
 #ifdef __WIN32__
 # define close(fd) closesocket(fd)
 #endif
+#ifndef O_CLOEXEC
+# define O_CLOEXEC 0
+#endif
 
 /* for tcp4 and tcp6 */
 #ifndef TCP_DOMAIN
 # define TCP_DOMAIN AF_UNSPEC
 #endif
 
+/* connections accepted per wakeup */
+#ifndef TCP_ACCEPT_MAX
+# define TCP_ACCEPT_MAX 64
+#endif
+
+/* frame headers */
+/* legacy frames only start with the length (most significant bit clear) */
+#define TCP_FRAME_LEGACY_SIZE	4
+/* versioned frames start with the marker and version, the flags, two reserved
+ * bytes and the length */
+#define TCP_FRAME_HEADER_SIZE	8
+#define TCP_FRAME_MARKER	0x80
+#define TCP_FRAME_VERSION	1
+/* largest frame accepted from the peer */
+#ifndef TCP_FRAME_MAX
+# define TCP_FRAME_MAX		(16 * 1024 * 1024)
+#endif
+/* frame version clients start with (0: until the server sends one) */
+#ifndef TCP_FRAME_CLIENT_VERSION
+# define TCP_FRAME_CLIENT_VERSION	0
+#endif
+
+
 
 /* TCP */
 /* private */
 /* types */
 typedef struct _AppTransportPlugin TCP;
 
+typedef struct _TCPSocketSegment
+{
+	struct _TCPSocketSegment * next;
+	unsigned char prefix[TCP_FRAME_HEADER_SIZE];
+	size_t prefix_size;
+	Buffer * buffer;
+} TCPSocketSegment;
+
 typedef struct _TCPSocket
 {
 	TCP * tcp;
 	AppTransportClient * client;
+	/* slot in the client table (for servers) */
+	size_t slot;
 
 	int fd;
-	struct sockaddr * sa;
+	struct sockaddr_storage sa;
 	socklen_t sa_len;
 
-	/* input queue */
+	/* frame version to send (0: legacy) */
+	unsigned int version;
+
+	/* input queue (scratch buffer for headers and small frames) */
 	char * bufin;
 	size_t bufin_cnt;
-	/* output queue */
-	char * bufout;
+	/* consume offset (the buffer is compacted once per event) */
+	size_t bufin_pos;
+	/* frame being received directly */
+	char * frame;
+	size_t frame_cnt;
+	size_t frame_size;
+	unsigned int frame_version;
+	/* output queue (one segment per message) */
+	TCPSocketSegment * bufout;
+	TCPSocketSegment * bufout_tail;
+	/* sliding cursor in the first segment */
+	size_t bufout_pos;
+	/* bytes left to send */
 	size_t bufout_cnt;
 } TCPSocket;
 
@@ -79,14 +133,29 @@ struct _AppTransportPlugin
 	struct addrinfo * ai;
 	struct addrinfo * aip;
 
+	/* recycles the messages received */
+	AppMessagePool * pool;
+
+	/* for clients: waiting for the messages to be sent */
+	int sending;
+
 	union
 	{
 		struct
 		{
 			/* for servers */
 			int fd;
+			/* released when running out of descriptors */
+			int reserve;
+			/* client table (free slots are NULL and stacked) */
 			TCPSocket ** clients;
+			size_t clients_size;
+			size_t clients_used;
+			size_t * clients_free;
+			size_t clients_free_cnt;
+			/* live and total connections */
 			size_t clients_cnt;
+			size_t clients_total;
 		} server;
 
 		/* for clients */
@@ -96,7 +165,9 @@ struct _AppTransportPlugin
 
 
 /* constants */
-#define INC 1024
+#define BUFIN_SIZE 16384
+#define POOL_SIZE 16
+#define SEGMENTS_MAX 32
 
 #include "common.h"
 #include "common.c"
@@ -110,14 +181,24 @@ static TCP * _tcp_init(AppTransportPluginHelper * helper, AppTransportMode mode,
 static void _tcp_destroy(TCP * tcp);
 
 static int _tcp_client_send(TCP * tcp, AppMessage * message);
+static int _tcp_client_queue(TCP * tcp, AppMessage * message);
 static int _tcp_server_send(TCP * tcp, AppTransportClient * client,
 		AppMessage * message);
+static int _tcp_server_get_client_name(TCP * tcp, AppTransportClient * client,
+		char * name, size_t size);
 
 /* useful */
 static int _tcp_error(char const * message);
 
+/* frames */
+static size_t _tcp_frame_header_parse(unsigned char const * p, size_t size,
+		unsigned int * version, unsigned int * flags, uint32_t * len);
+static size_t _tcp_frame_header_write(unsigned char * p, unsigned int version,
+		unsigned int flags, uint32_t len);
+
 /* servers */
 static int _tcp_server_add_client(TCP * tcp, TCPSocket * client);
+static void _tcp_server_remove_client(TCP * tcp, TCPSocket * client);
 
 /* sockets */
 static int _tcp_socket_init(TCPSocket * tcpsocket, int domain, int flags,
@@ -129,6 +210,8 @@ static TCPSocket * _tcp_socket_new_fd(TCP * tcp, int fd, struct sockaddr * sa,
 static void _tcp_socket_delete(TCPSocket * tcpsocket);
 static void _tcp_socket_destroy(TCPSocket * tcpsocket);
 
+static void _tcp_socket_close(TCPSocket * tcpsocket);
+
 static int _tcp_socket_queue(TCPSocket * tcpsocket, Buffer * buffer);
 
 /* callbacks */
@@ -151,7 +234,9 @@ AppTransportPluginDefinition transport =
 	_tcp_init,
 	_tcp_destroy,
 	_tcp_client_send,
-	_tcp_server_send
+	_tcp_server_send,
+	_tcp_server_get_client_name,
+	_tcp_client_queue
 };
 
 
@@ -175,6 +260,11 @@ static TCP * _tcp_init(AppTransportPluginHelper * helper, AppTransportMode mode,
 		return NULL;
 	memset(tcp, 0, sizeof(*tcp));
 	tcp->helper = helper;
+	if((tcp->pool = appmessage_pool_new(POOL_SIZE)) == NULL)
+	{
+		object_delete(tcp);
+		return NULL;
+	}
 	switch((tcp->mode = mode))
 	{
 		case ATM_CLIENT:
@@ -210,7 +300,7 @@ static int _init_client(TCP * tcp, char const * name, int domain)
 	tcp->u.client.tcp = tcp;
 	tcp->u.client.fd = -1;
 	/* obtain the remote address */
-	if((tcp->ai = _init_address(name, domain, 0)) == NULL)
+	if((tcp->ai = _init_address(tcp->helper, name, domain, 0)) == NULL)
 		return -1;
 	/* connect to the remote host */
 	for(tcp->aip = tcp->ai; tcp->aip != NULL; tcp->aip = tcp->aip->ai_next)
@@ -257,6 +347,8 @@ static int _init_client(TCP * tcp, char const * name, int domain)
 	}
 	if(tcp->aip == NULL)
 		return -1;
+	/* legacy servers do not understand versioned frames */
+	tcp->u.client.version = TCP_FRAME_CLIENT_VERSION;
 	/* listen for any incoming message */
 	event_register_io_read(tcp->helper->event, tcp->u.client.fd,
 			(EventIOFunc)_tcp_socket_callback_read, &tcp->u.client);
@@ -266,7 +358,9 @@ static int _init_client(TCP * tcp, char const * name, int domain)
 		event_register_io_write(tcp->helper->event, tcp->u.client.fd,
 				(EventIOFunc)_tcp_socket_callback_write,
 				&tcp->u.client);
+		tcp->sending = 1;
 		event_loop(tcp->helper->event);
+		tcp->sending = 0;
 	}
 	return 0;
 }
@@ -279,8 +373,15 @@ static int _init_server(TCP * tcp, char const * name, int domain)
 #endif
 
 	tcp->u.server.fd = -1;
+#ifndef __WIN32__
+	/* keep a descriptor aside to turn clients down gracefully */
+	tcp->u.server.reserve = open("/dev/null", O_RDONLY | O_CLOEXEC);
+#else
+	tcp->u.server.reserve = -1;
+#endif
 	/* obtain the local address */
-	if((tcp->ai = _init_address(name, domain, AI_PASSIVE)) == NULL)
+	if((tcp->ai = _init_address(tcp->helper, name, domain, AI_PASSIVE))
+			== NULL)
 		return -1;
 	for(tcp->aip = tcp->ai; tcp->aip != NULL; tcp->aip = tcp->aip->ai_next)
 	{
@@ -303,7 +404,8 @@ static int _init_server(TCP * tcp, char const * name, int domain)
 			fprintf(stderr, "DEBUG: %s() %s %d\n", __func__,
 					"bind()", tcp->aip->ai_family);
 #endif
-		if(bind(tcp->u.server.fd, tcp->aip->ai_addr,
+		if(_share_socket(tcp->helper, tcp->u.server.fd) != 0
+				|| bind(tcp->u.server.fd, tcp->aip->ai_addr,
 					tcp->aip->ai_addrlen) != 0)
 		{
 			_tcp_error("bind");
@@ -347,8 +449,9 @@ static void _tcp_destroy(TCP * tcp)
 			_destroy_server(tcp);
 			break;
 	}
-	if(tcp->ai != NULL)
-		freeaddrinfo(tcp->ai);
+	_destroy_address(tcp->helper, tcp->ai);
+	if(tcp->pool != NULL)
+		appmessage_pool_delete(tcp->pool);
 	object_delete(tcp);
 }
 
@@ -361,30 +464,53 @@ static void _destroy_server(TCP * tcp)
 {
 	size_t i;
 
-	for(i = 0; i < tcp->u.server.clients_cnt; i++)
-		_tcp_socket_delete(tcp->u.server.clients[i]);
+	for(i = 0; i < tcp->u.server.clients_used; i++)
+		if(tcp->u.server.clients[i] != NULL)
+			_tcp_socket_delete(tcp->u.server.clients[i]);
 	free(tcp->u.server.clients);
+	free(tcp->u.server.clients_free);
 	if(tcp->u.server.fd >= 0)
 		close(tcp->u.server.fd);
+	if(tcp->u.server.reserve >= 0)
+		close(tcp->u.server.reserve);
 }
 
 
 /* tcp_client_send */
 static int _tcp_client_send(TCP * tcp, AppMessage * message)
+{
+	int ret;
+
+	if((ret = _tcp_client_queue(tcp, message)) != 0)
+		return ret;
+	/* wait until every message queued was sent */
+	tcp->sending = 1;
+	event_loop(tcp->helper->event);
+	tcp->sending = 0;
+	return 0;
+}
+
+
+/* tcp_client_queue */
+static int _tcp_client_queue(TCP * tcp, AppMessage * message)
 {
 	int ret;
 	Buffer * buffer;
 
 	if(tcp->mode != ATM_CLIENT)
 		return -error_set_code(1, "%s", "Not a client");
-	/* send the message */
+	/* queue the message */
 	if((buffer = buffer_new(0, NULL)) == NULL)
 		return -1;
-	if((ret = appmessage_serialize(message, buffer)) == 0
-			&& (ret = _tcp_socket_queue(&tcp->u.client, buffer)) == 0)
-		event_loop(tcp->helper->event);
-	buffer_delete(buffer);
-	return ret;
+	/* the buffer is released once sent */
+	if((ret = appmessage_serialize(message, buffer)) != 0
+			|| (ret = _tcp_socket_queue(&tcp->u.client, buffer))
+			!= 0)
+	{
+		buffer_delete(buffer);
+		return ret;
+	}
+	return 0;
 }
 
 
@@ -392,24 +518,20 @@ static int _tcp_client_send(TCP * tcp, AppMessage * message)
 static int _tcp_server_send(TCP * tcp, AppTransportClient * client,
 		AppMessage * message)
 {
-	size_t i;
+	AppTransportPluginHelper * helper = tcp->helper;
 	TCPSocket * s;
 	Buffer * buffer;
 
 	if(tcp->mode != ATM_SERVER)
 		return -error_set_code(1, "%s", "Not a server");
-	/* lookup the client */
-	for(i = 0; i < tcp->u.server.clients_cnt; i++)
-	{
-		s = tcp->u.server.clients[i];
-		if(s->client == client)
-			break;
-	}
-	if(i == tcp->u.server.clients_cnt)
+	/* obtain the socket of the client */
+	if((s = helper->client_get_data(helper->transport, client)) == NULL
+			|| s->tcp != tcp || s->client != client)
 		return -error_set_code(1, "%s", "Unknown client");
 	/* send the message */
 	if((buffer = buffer_new(0, NULL)) == NULL)
 		return -1;
+	/* the buffer is released once sent */
 	if(appmessage_serialize(message, buffer) != 0
 			|| _tcp_socket_queue(s, buffer) != 0)
 	{
@@ -420,6 +542,23 @@ static int _tcp_server_send(TCP * tcp, AppTransportClient * client,
 }
 
 
+/* tcp_server_get_client_name */
+static int _tcp_server_get_client_name(TCP * tcp, AppTransportClient * client,
+		char * name, size_t size)
+{
+	AppTransportPluginHelper * helper = tcp->helper;
+	TCPSocket * s;
+
+	if(tcp->mode != ATM_SERVER)
+		return -error_set_code(1, "%s", "Not a server");
+	if((s = helper->client_get_data(helper->transport, client)) == NULL
+			|| s->tcp != tcp || s->client != client)
+		return -error_set_code(1, "%s", "Unknown client");
+	return _lookup_name((struct sockaddr *)&s->sa, s->sa_len,
+			NI_NUMERICSERV, name, size);
+}
+
+
 /* useful */
 /* tcp_error */
 static int _tcp_error(char const * message)
@@ -433,11 +572,67 @@ static int _tcp_error(char const * message)
 }
 
 
+/* frames */
+/* tcp_frame_header_parse */
+static size_t _tcp_frame_header_parse(unsigned char const * p, size_t size,
+		unsigned int * version, unsigned int * flags, uint32_t * len)
+{
+	size_t header = TCP_FRAME_HEADER_SIZE;
+
+	if(size < TCP_FRAME_LEGACY_SIZE)
+		return 0;
+	if((p[0] & TCP_FRAME_MARKER) == 0)
+	{
+		/* legacy frame */
+		*version = 0;
+		*flags = 0;
+		header = TCP_FRAME_LEGACY_SIZE;
+	}
+	else if(size < header)
+		return 0;
+	else
+	{
+		*version = p[0] & ~TCP_FRAME_MARKER;
+		*flags = p[1];
+		p += header - TCP_FRAME_LEGACY_SIZE;
+	}
+	*len = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+		| ((uint32_t)p[2] << 8) | p[3];
+	return header;
+}
+
+
+/* tcp_frame_header_write */
+static size_t _tcp_frame_header_write(unsigned char * p, unsigned int version,
+		unsigned int flags, uint32_t len)
+{
+	size_t header = TCP_FRAME_LEGACY_SIZE;
+
+	if(version != 0)
+	{
+		*(p++) = TCP_FRAME_MARKER | version;
+		*(p++) = flags;
+		*(p++) = 0;
+		*(p++) = 0;
+		header = TCP_FRAME_HEADER_SIZE;
+	}
+	/* the length is in network byte order */
+	p[0] = (len >> 24) & 0xff;
+	p[1] = (len >> 16) & 0xff;
+	p[2] = (len >> 8) & 0xff;
+	p[3] = len & 0xff;
+	return header;
+}
+
+
 /* servers */
 /* tcp_server_add_client */
 static int _tcp_server_add_client(TCP * tcp, TCPSocket * client)
 {
 	TCPSocket ** p;
+	size_t * q;
+	size_t size;
+	size_t slot;
 #ifndef NI_MAXHOST
 # define NI_MAXHOST 256
 #endif
@@ -445,26 +640,66 @@ static int _tcp_server_add_client(TCP * tcp, TCPSocket * client)
 	char const * name = host;
 	const int flags = NI_NUMERICSERV;
 
-	if((p = realloc(tcp->u.server.clients, sizeof(*p)
-					* (tcp->u.server.clients_cnt + 1)))
-			== NULL)
-		return -1;
-	tcp->u.server.clients = p;
-	/* XXX may not be instant */
-	if(getnameinfo(client->sa, client->sa_len, host, sizeof(host), NULL, 0,
-				NI_NAMEREQD | flags) != 0
-			&& getnameinfo(client->sa, client->sa_len, host,
+	/* grow the table if there is no free slot left */
+	if(tcp->u.server.clients_free_cnt == 0
+			&& tcp->u.server.clients_used
+			== tcp->u.server.clients_size)
+	{
+		size = (tcp->u.server.clients_size > 0)
+			? tcp->u.server.clients_size * 2 : 16;
+		if((p = realloc(tcp->u.server.clients, sizeof(*p) * size))
+				== NULL)
+			return -_tcp_error(NULL);
+		tcp->u.server.clients = p;
+		if((q = realloc(tcp->u.server.clients_free, sizeof(*q) * size))
+				== NULL)
+			return -_tcp_error(NULL);
+		tcp->u.server.clients_free = q;
+		tcp->u.server.clients_size = size;
+	}
+	/* the name is resolved later if necessary */
+	if(getnameinfo((struct sockaddr *)&client->sa, client->sa_len, host,
 				sizeof(host), NULL, 0, NI_NUMERICHOST | flags)
 			!= 0)
 		name = NULL;
 	if((client->client = tcp->helper->client_new(tcp->helper->transport,
 					name)) == NULL)
 		return -1;
-	tcp->u.server.clients[tcp->u.server.clients_cnt++] = client;
+	tcp->helper->client_set_data(tcp->helper->transport, client->client,
+			client);
+	if(tcp->u.server.clients_free_cnt > 0)
+		slot = tcp->u.server.clients_free[
+			--tcp->u.server.clients_free_cnt];
+	else
+		slot = tcp->u.server.clients_used++;
+	tcp->u.server.clients[slot] = client;
+	client->slot = slot;
+	tcp->u.server.clients_cnt++;
+	tcp->u.server.clients_total++;
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s() %lu/%lu clients\n", __func__,
+			tcp->u.server.clients_cnt, tcp->u.server.clients_total);
+#endif
 	return 0;
 }
 
 
+/* tcp_server_remove_client */
+static void _tcp_server_remove_client(TCP * tcp, TCPSocket * client)
+{
+	tcp->u.server.clients[client->slot] = NULL;
+	tcp->u.server.clients_free[tcp->u.server.clients_free_cnt++]
+		= client->slot;
+	tcp->u.server.clients_cnt--;
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s() %lu/%lu clients\n", __func__,
+			tcp->u.server.clients_cnt, tcp->u.server.clients_total);
+#endif
+	/* release the buffers and the client right away */
+	_tcp_socket_delete(client);
+}
+
+
 /* sockets */
 /* tcp_socket_init */
 static int _tcp_socket_init(TCPSocket * tcpsocket, int domain, int flags,
@@ -499,12 +734,26 @@ static void _tcp_socket_init_fd(TCPSocket * tcpsocket, TCP * tcp, int fd,
 {
 	tcpsocket->tcp = tcp;
 	tcpsocket->client = NULL;
+	tcpsocket->slot = 0;
 	tcpsocket->fd = fd;
-	tcpsocket->sa = sa;
+	/* the address is kept inline */
+	if(sa != NULL && sa_len <= sizeof(tcpsocket->sa))
+		memcpy(&tcpsocket->sa, sa, sa_len);
+	else
+		sa_len = 0;
 	tcpsocket->sa_len = sa_len;
+	/* legacy frames until the peer is known to support versioned ones */
+	tcpsocket->version = 0;
 	tcpsocket->bufin = NULL;
 	tcpsocket->bufin_cnt = 0;
+	tcpsocket->bufin_pos = 0;
+	tcpsocket->frame = NULL;
+	tcpsocket->frame_cnt = 0;
+	tcpsocket->frame_size = 0;
+	tcpsocket->frame_version = 0;
 	tcpsocket->bufout = NULL;
+	tcpsocket->bufout_tail = NULL;
+	tcpsocket->bufout_pos = 0;
 	tcpsocket->bufout_cnt = 0;
 }
 
@@ -535,63 +784,66 @@ static void _tcp_socket_destroy(TCPSocket * tcpsocket)
 {
 	TCP * tcp = tcpsocket->tcp;
 	AppTransportPluginHelper * helper = tcp->helper;
+	TCPSocketSegment * segment;
 
 	helper->client_delete(helper->transport, tcpsocket->client);
-	free(tcpsocket->sa);
-	if(tcpsocket->fd >= 0)
-	{
-		event_unregister_io_read(tcpsocket->tcp->helper->event,
-				tcpsocket->fd);
-		event_unregister_io_write(tcpsocket->tcp->helper->event,
-				tcpsocket->fd);
-		close(tcpsocket->fd);
-	}
+	_tcp_socket_close(tcpsocket);
 	free(tcpsocket->bufin);
-	free(tcpsocket->bufout);
+	free(tcpsocket->frame);
+	while((segment = tcpsocket->bufout) != NULL)
+	{
+		tcpsocket->bufout = segment->next;
+		buffer_delete(segment->buffer);
+		free(segment);
+	}
+}
+
+
+/* tcp_socket_close */
+static void _tcp_socket_close(TCPSocket * tcpsocket)
+{
+	Event * event = tcpsocket->tcp->helper->event;
+
+	if(tcpsocket->fd < 0)
+		return;
+	event_unregister_io_read(event, tcpsocket->fd);
+	event_unregister_io_write(event, tcpsocket->fd);
+	close(tcpsocket->fd);
+	tcpsocket->fd = -1;
 }
 
 
 /* tcp_socket_queue */
 static int _tcp_socket_queue(TCPSocket * tcpsocket, Buffer * buffer)
 {
-	uint32_t len;
-	char * p;
-	Variable * v;
-	Buffer * b = NULL;
+	size_t size = buffer_get_size(buffer);
+	TCPSocketSegment * segment;
 
 #ifdef DEBUG
 	fprintf(stderr, "DEBUG: %s(%d)\n", __func__, tcpsocket->fd);
 #endif
-	/* serialize the buffer */
-	v = variable_new(VT_BUFFER, buffer);
-	b = buffer_new(0, NULL);
-	if(v == NULL || b == NULL || variable_serialize(v, b, 0) != 0)
-	{
-		if(v != NULL)
-			variable_delete(v);
-		if(b != NULL)
-			buffer_delete(b);
-		return -1;
-	}
-	variable_delete(v);
-	len = buffer_get_size(b);
-	/* FIXME queue the serialized buffer directly as a message instead */
-	if((p = realloc(tcpsocket->bufout, tcpsocket->bufout_cnt + len))
-			== NULL)
-	{
-		buffer_delete(b);
-		return -1;
-	}
-	tcpsocket->bufout = p;
-	memcpy(&p[tcpsocket->bufout_cnt], buffer_get_data(b), len);
+	/* legacy frames cannot have the most significant bit set */
+	if(size > ((tcpsocket->version != 0) ? UINT32_MAX : INT32_MAX))
+		return -error_set_code(-ERANGE, "%s", strerror(ERANGE));
+	if((segment = malloc(sizeof(*segment))) == NULL)
+		return -_tcp_error(NULL);
+	segment->next = NULL;
+	segment->prefix_size = _tcp_frame_header_write(segment->prefix,
+			tcpsocket->version, 0, size);
+	/* the message is sent from the buffer directly */
+	segment->buffer = buffer;
+	if(tcpsocket->bufout_tail != NULL)
+		tcpsocket->bufout_tail->next = segment;
+	else
+		tcpsocket->bufout = segment;
+	tcpsocket->bufout_tail = segment;
 	/* register the callback if necessary */
 	if(tcpsocket->bufout_cnt == 0)
 		event_register_io_write(tcpsocket->tcp->helper->event,
 				tcpsocket->fd,
 				(EventIOFunc)_tcp_socket_callback_write,
 				tcpsocket);
-	tcpsocket->bufout_cnt += len;
-	buffer_delete(b);
+	tcpsocket->bufout_cnt += segment->prefix_size + size;
 #ifdef DEBUG
 	fprintf(stderr, "DEBUG: %s(%d) => %d\n", __func__, tcpsocket->fd, 0);
 #endif
@@ -604,10 +856,14 @@ static int _tcp_socket_queue(TCPSocket * tcpsocket, Buffer * buffer)
 static int _accept_client(TCP * tcp, int fd, struct sockaddr * sa,
 		socklen_t sa_len);
 
+static int _accept_reserve(TCP * tcp);
+
 static int _tcp_callback_accept(int fd, TCP * tcp)
 {
-	struct sockaddr * sa;
-	socklen_t sa_len = tcp->aip->ai_addrlen;
+	struct sockaddr_storage sa;
+	socklen_t sa_len;
+	int cfd;
+	size_t i;
 
 #ifdef DEBUG
 	fprintf(stderr, "DEBUG: %s(%d)\n", __func__, fd);
@@ -615,35 +871,79 @@ static int _tcp_callback_accept(int fd, TCP * tcp)
 	/* check parameters */
 	if(tcp->u.server.fd != fd)
 		return -1;
-	if((sa = malloc(sa_len)) == NULL)
-		/* XXX this may not be enough to recover */
-		sa_len = 0;
-	if((fd = accept(fd, sa, &sa_len)) < 0)
+	/* drain the backlog (up to a limit) */
+	for(i = 0; i < TCP_ACCEPT_MAX; i++)
 	{
-		free(sa);
-		return _tcp_error("accept");
+		sa_len = sizeof(sa);
+#if defined(SOCK_NONBLOCK) && defined(SOCK_CLOEXEC)
+		cfd = accept4(fd, (struct sockaddr *)&sa, &sa_len,
+				SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+		cfd = accept(fd, (struct sockaddr *)&sa, &sa_len);
+#endif
+		if(cfd < 0)
+		{
+			if(errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if((errno == EMFILE || errno == ENFILE)
+					&& _accept_reserve(tcp) == 0)
+				continue;
+			if(errno != EAGAIN && errno != EWOULDBLOCK)
+				/* FIXME report error */
+				_tcp_error("accept");
+			break;
+		}
+		if(_accept_client(tcp, cfd, (struct sockaddr *)&sa, sa_len)
+				!= 0)
+			/* just close the connection and keep serving */
+			/* FIXME report error */
+			close(cfd);
+#ifdef DEBUG
+		else
+			fprintf(stderr, "DEBUG: %s() %d\n", __func__, cfd);
+#endif
 	}
-	if(_accept_client(tcp, fd, sa, sa_len) != 0)
-	{
-		/* just close the connection and keep serving */
-		/* FIXME report error */
+	return 0;
+}
+
+static int _accept_reserve(TCP * tcp)
+{
+	int fd;
+
+	/* use the reserve to accept and close the connection */
+	if(tcp->u.server.reserve < 0)
+		return -1;
+	close(tcp->u.server.reserve);
+	if((fd = accept(tcp->u.server.fd, NULL, NULL)) >= 0)
 		close(fd);
-		free(sa);
-	}
 #ifdef DEBUG
-	else
-		fprintf(stderr, "DEBUG: %s() %d\n", __func__, fd);
+	fprintf(stderr, "DEBUG: %s() %s\n", __func__,
+			"Out of descriptors, connection refused");
 #endif
-	return 0;
+	tcp->u.server.reserve = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	return (fd >= 0) ? 0 : -1;
 }
 
 static int _accept_client(TCP * tcp, int fd, struct sockaddr * sa,
 		socklen_t sa_len)
 {
 	TCPSocket * tcpsocket;
+#if !defined(SOCK_NONBLOCK) || !defined(SOCK_CLOEXEC)
+	int f;
+#endif
 
 #ifdef DEBUG
 	fprintf(stderr, "DEBUG: %s(%d)\n", __func__, fd);
+#endif
+#if !defined(SOCK_NONBLOCK) || !defined(SOCK_CLOEXEC)
+	/* the socket is read until it would block */
+	if((f = fcntl(fd, F_GETFL)) == -1
+			|| ((f & O_NONBLOCK) == 0
+				&& fcntl(fd, F_SETFL, f | O_NONBLOCK) == -1))
+		return -_tcp_error("fcntl");
+# ifdef FD_CLOEXEC
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+# endif
 #endif
 	if((tcpsocket = _tcp_socket_new_fd(tcp, fd, sa, sa_len)) == NULL)
 		return -1;
@@ -718,9 +1018,11 @@ static void _socket_callback_read_client(TCPSocket * tcpsocket,
 static void _socket_callback_read_server(TCPSocket * tcpsocket,
 		AppMessage * message);
 static int _socket_callback_recv(TCPSocket * tcpsocket);
+static void _socket_callback_compact(TCPSocket * tcpsocket);
 
 static int _tcp_socket_callback_read(int fd, TCPSocket * tcpsocket)
 {
+	int res;
 	AppMessage * message;
 
 #ifdef DEBUG
@@ -729,48 +1031,129 @@ static int _tcp_socket_callback_read(int fd, TCPSocket * tcpsocket)
 	/* check parameters */
 	if(tcpsocket->fd != fd)
 		return -1;
-	if(_socket_callback_recv(tcpsocket) != 0)
-		return -1;
-	while((message = _socket_callback_message(tcpsocket)) != NULL)
+	/* read until the socket would block */
+	while((res = _socket_callback_recv(tcpsocket)) > 0)
 	{
-		switch(tcpsocket->tcp->mode)
+		while((message = _socket_callback_message(tcpsocket)) != NULL)
 		{
-			case ATM_CLIENT:
-				_socket_callback_read_client(tcpsocket,
-						message);
-				break;
-			case ATM_SERVER:
-				_socket_callback_read_server(tcpsocket,
-						message);
-				break;
+			switch(tcpsocket->tcp->mode)
+			{
+				case ATM_CLIENT:
+					_socket_callback_read_client(tcpsocket,
+							message);
+					break;
+				case ATM_SERVER:
+					_socket_callback_read_server(tcpsocket,
+							message);
+					break;
+			}
+			appmessage_delete(message);
 		}
-		appmessage_delete(message);
+		if(tcpsocket->fd < 0)
+			break;
+	}
+	if(res < 0 || tcpsocket->fd < 0)
+	{
+		/* forget about disconnected clients */
+		if(tcpsocket->tcp->mode == ATM_SERVER)
+			_tcp_server_remove_client(tcpsocket->tcp, tcpsocket);
+		return -1;
 	}
+	/* keep the incomplete header at the beginning of the buffer */
+	_socket_callback_compact(tcpsocket);
 	return 0;
 }
 
 static AppMessage * _socket_callback_message(TCPSocket * tcpsocket)
 {
-	AppMessage * message = NULL;
+	AppMessage * message;
+	unsigned char const * p;
+	unsigned int version;
+	unsigned int flags;
+	uint32_t len;
+	size_t header;
 	size_t size;
-	Variable * variable;
-	Buffer * buffer;
+	char * data;
+	AppMessageFrame * frame;
 
-	size = tcpsocket->bufin_cnt;
-	/* deserialize the data as a buffer (containing a message) */
-	if((variable = variable_new_deserialize_type(VT_BUFFER, &size,
-					tcpsocket->bufin)) == NULL)
-		/* XXX assumes not enough data was available */
-		return NULL;
-	tcpsocket->bufin_cnt -= size;
-	memmove(tcpsocket->bufin, &tcpsocket->bufin[size],
-			tcpsocket->bufin_cnt);
-	if((variable_get_as(variable, VT_BUFFER, &buffer, NULL)) == 0)
+	for(;;)
 	{
-		message = appmessage_new_deserialize(buffer);
-		buffer_delete(buffer);
+		if(tcpsocket->frame != NULL)
+		{
+			/* the frame is being received directly */
+			if(tcpsocket->frame_cnt < tcpsocket->frame_size)
+				return NULL;
+			data = tcpsocket->frame;
+			len = tcpsocket->frame_size;
+			version = tcpsocket->frame_version;
+			tcpsocket->frame = NULL;
+			tcpsocket->frame_cnt = 0;
+			tcpsocket->frame_size = 0;
+		}
+		else
+		{
+			/* parse the frame header */
+			p = (unsigned char *)&tcpsocket->bufin[
+				tcpsocket->bufin_pos];
+			size = tcpsocket->bufin_cnt - tcpsocket->bufin_pos;
+			if((header = _tcp_frame_header_parse(p, size,
+							&version, &flags, &len))
+					== 0)
+				/* not enough data was available yet */
+				return NULL;
+			if(len > TCP_FRAME_MAX)
+			{
+				/* do not let the peer allocate at will */
+				error_set_code(-EMSGSIZE, "%s",
+						strerror(EMSGSIZE));
+				_tcp_socket_close(tcpsocket);
+				return NULL;
+			}
+			/* the message will borrow from this frame */
+			if((data = malloc(len)) == NULL && len > 0)
+			{
+				/* XXX report error */
+				_tcp_error(NULL);
+				_tcp_socket_close(tcpsocket);
+				return NULL;
+			}
+			if((size -= header) > len)
+				size = len;
+			memcpy(data, &p[header], size);
+			/* only move the consume offset */
+			tcpsocket->bufin_pos += header + size;
+			if(tcpsocket->bufin_pos == tcpsocket->bufin_cnt)
+				tcpsocket->bufin_pos = tcpsocket->bufin_cnt = 0;
+			if(size < len)
+			{
+				/* receive the rest of the frame directly */
+				tcpsocket->frame = data;
+				tcpsocket->frame_cnt = size;
+				tcpsocket->frame_size = len;
+				tcpsocket->frame_version = version;
+				return NULL;
+			}
+		}
+		if(version <= TCP_FRAME_VERSION)
+			break;
+		/* skip frames from newer versions of the protocol */
+#ifdef DEBUG
+		fprintf(stderr, "DEBUG: %s() unsupported version %u\n",
+				__func__, version);
+#endif
+		free(data);
 	}
-	variable_delete(variable);
+	/* reply with versioned frames if the peer supports them */
+	if(version > tcpsocket->version)
+		tcpsocket->version = version;
+	if((frame = appmessage_frame_new(data, len)) == NULL)
+	{
+		free(data);
+		return NULL;
+	}
+	message = appmessage_new_deserialize_pool(tcpsocket->tcp->pool, frame,
+			0, len);
+	appmessage_frame_unref(frame);
 	return message;
 }
 
@@ -787,25 +1170,46 @@ static void _socket_callback_read_server(TCPSocket * tcpsocket,
 {
 	AppTransportPluginHelper * helper = tcpsocket->tcp->helper;
 
+	/* the clients announcing themselves support versioned frames */
+	if(appmessage_get_type(message) == AMT_ACKNOWLEDGEMENT
+			&& tcpsocket->version < TCP_FRAME_VERSION)
+		tcpsocket->version = TCP_FRAME_VERSION;
 	helper->client_receive(helper->transport, tcpsocket->client,
 			message);
 }
 
 static int _socket_callback_recv(TCPSocket * tcpsocket)
 {
-	const size_t inc = INC;
-	ssize_t ssize;
 	char * p;
+	size_t size;
+	ssize_t ssize;
 
-	if((p = realloc(tcpsocket->bufin, tcpsocket->bufin_cnt + inc)) == NULL)
-		return -1;
-	tcpsocket->bufin = p;
-	if((ssize = recv(tcpsocket->fd, &tcpsocket->bufin[tcpsocket->bufin_cnt],
-					inc, 0)) < 0)
+	if(tcpsocket->frame != NULL)
+	{
+		/* receive the payload in place */
+		p = &tcpsocket->frame[tcpsocket->frame_cnt];
+		size = tcpsocket->frame_size - tcpsocket->frame_cnt;
+	}
+	else
+	{
+		/* the scratch buffer is allocated once */
+		if(tcpsocket->bufin == NULL
+				&& (tcpsocket->bufin = malloc(BUFIN_SIZE))
+				== NULL)
+			return -_tcp_error(NULL);
+		/* only an incomplete header can be left to move */
+		if(tcpsocket->bufin_cnt == BUFIN_SIZE)
+			_socket_callback_compact(tcpsocket);
+		p = &tcpsocket->bufin[tcpsocket->bufin_cnt];
+		size = BUFIN_SIZE - tcpsocket->bufin_cnt;
+	}
+	if((ssize = recv(tcpsocket->fd, p, size, 0)) < 0)
 	{
+		if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			/* wait until more data is available */
+			return 0;
 		error_set_code(-errno, "%s", strerror(errno));
-		close(tcpsocket->fd);
-		tcpsocket->fd = -1;
+		_tcp_socket_close(tcpsocket);
 		/* FIXME report error */
 		return -1;
 	}
@@ -814,19 +1218,36 @@ static int _socket_callback_recv(TCPSocket * tcpsocket)
 #ifdef DEBUG
 		fprintf(stderr, "DEBUG: %s() recv() => %ld\n", __func__, ssize);
 #endif
-		close(tcpsocket->fd);
-		tcpsocket->fd = -1;
+		_tcp_socket_close(tcpsocket);
 		/* FIXME report transfer clean shutdown */
 		return -1;
 	}
-	tcpsocket->bufin_cnt += ssize;
-	return 0;
+	if(tcpsocket->frame != NULL)
+		tcpsocket->frame_cnt += ssize;
+	else
+		tcpsocket->bufin_cnt += ssize;
+	return 1;
+}
+
+static void _socket_callback_compact(TCPSocket * tcpsocket)
+{
+	if(tcpsocket->bufin_pos == 0)
+		return;
+	tcpsocket->bufin_cnt -= tcpsocket->bufin_pos;
+	memmove(tcpsocket->bufin, &tcpsocket->bufin[tcpsocket->bufin_pos],
+			tcpsocket->bufin_cnt);
+	tcpsocket->bufin_pos = 0;
 }
 
 
 /* tcp_socket_callback_write */
 static int _tcp_socket_callback_write(int fd, TCPSocket * tcpsocket)
 {
+	struct iovec iov[SEGMENTS_MAX * 2];
+	int iov_cnt = 0;
+	TCPSocketSegment * segment;
+	size_t pos = tcpsocket->bufout_pos;
+	size_t size;
 	ssize_t ssize;
 
 #ifdef DEBUG
@@ -835,33 +1256,61 @@ static int _tcp_socket_callback_write(int fd, TCPSocket * tcpsocket)
 	/* check parameters */
 	if(tcpsocket->fd != fd)
 		return -1;
-	if((ssize = send(tcpsocket->fd, tcpsocket->bufout,
-					tcpsocket->bufout_cnt, 0)) < 0)
+	/* gather as many messages as possible */
+	for(segment = tcpsocket->bufout; segment != NULL
+			&& iov_cnt + 2 <= SEGMENTS_MAX * 2;
+			segment = segment->next, pos = 0)
+	{
+		if(pos < segment->prefix_size)
+		{
+			iov[iov_cnt].iov_base = &segment->prefix[pos];
+			iov[iov_cnt++].iov_len = segment->prefix_size - pos;
+			pos = 0;
+		}
+		else
+			pos -= segment->prefix_size;
+		if((size = buffer_get_size(segment->buffer)) > pos)
+		{
+			iov[iov_cnt].iov_base = buffer_get_data(segment->buffer)
+				+ pos;
+			iov[iov_cnt++].iov_len = size - pos;
+		}
+	}
+	if((ssize = writev(tcpsocket->fd, iov, iov_cnt)) <= 0)
 	{
+		if(ssize < 0 && (errno == EAGAIN || errno == EWOULDBLOCK
+					|| errno == EINTR))
+			return 0;
 		/* XXX report error (and reconnect) */
 		error_set_code(-errno, "%s", strerror(errno));
-		close(tcpsocket->fd);
-		tcpsocket->fd = -1;
+		_tcp_socket_close(tcpsocket);
+		/* forget about disconnected clients */
+		if(tcpsocket->tcp->mode == ATM_SERVER)
+			_tcp_server_remove_client(tcpsocket->tcp, tcpsocket);
 		return -1;
 	}
-	else if(ssize == 0)
-	{
-		close(tcpsocket->fd);
-		tcpsocket->fd = -1;
-		/* XXX report transfer interruption (and reconnect) */
-		return -error_set_code(-errno, "%s", strerror(errno));
-	}
 #ifdef DEBUG
-	fprintf(stderr, "DEBUG: %s() send() => %ld\n", __func__, ssize);
+	fprintf(stderr, "DEBUG: %s() writev() => %ld\n", __func__, ssize);
 #endif
-	/* XXX use a sliding cursor instead (and then queue the next message) */
-	memmove(tcpsocket->bufout, &tcpsocket->bufout[ssize],
-			tcpsocket->bufout_cnt - ssize);
+	/* only move the cursor (and release the messages sent) */
 	tcpsocket->bufout_cnt -= ssize;
+	for(pos = tcpsocket->bufout_pos + ssize;
+			(segment = tcpsocket->bufout) != NULL; pos -= size)
+	{
+		size = segment->prefix_size + buffer_get_size(segment->buffer);
+		if(pos < size)
+			break;
+		if((tcpsocket->bufout = segment->next) == NULL)
+			tcpsocket->bufout_tail = NULL;
+		buffer_delete(segment->buffer);
+		free(segment);
+	}
+	tcpsocket->bufout_pos = pos;
 	/* unregister the callback if there is nothing left to write */
 	if(tcpsocket->bufout_cnt == 0)
 	{
-		if(tcpsocket->tcp->mode == ATM_CLIENT)
+		if(tcpsocket->tcp->mode == ATM_CLIENT
+				&& tcpsocket->tcp->sending)
 			event_loop_quit(tcpsocket->tcp->helper->event);
 		return 1;
 	}
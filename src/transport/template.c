@@ -49,6 +49,8 @@ AppTransportPluginDefinition transport =
 	_template_init,
 	_template_destroy,
 	NULL,
+	NULL,
+	NULL,
 	NULL
 };
 
@@ -21,11 +21,10 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
-#ifdef DEBUG
-# include <stdio.h>
-#endif
+#include <stdio.h>
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
 #include <limits.h>
 #include <errno.h>
 #ifdef __WIN32__
@@ -79,6 +78,9 @@ struct _AppTransportPlugin
 	struct addrinfo * ai;
 	struct addrinfo * aip;
 
+	/* recycles the messages received */
+	AppMessagePool * pool;
+
 	union
 	{
 		struct
@@ -94,6 +96,10 @@ struct _AppTransportPlugin
 	size_t messages_cnt;
 };
 
+
+/* constants */
+#define POOL_SIZE 16
+
 #include "common.h"
 #include "common.c"
 
@@ -107,6 +113,8 @@ static void _udp_destroy(UDP * udp);
 
 static int _udp_client_send(UDP * udp, AppTransportClient * client,
 		AppMessage * message);
+static int _udp_client_get_name(UDP * udp, AppTransportClient * client,
+		char * name, size_t size);
 static int _udp_send(UDP * udp, AppMessage * message);
 
 /* useful */
@@ -133,7 +141,10 @@ AppTransportPluginDefinition transport =
 	_udp_init,
 	_udp_destroy,
 	_udp_send,
-	_udp_client_send
+	_udp_client_send,
+	_udp_client_get_name,
+	/* sending never blocks */
+	_udp_send
 };
 
 
@@ -159,6 +170,11 @@ static UDP * _udp_init(AppTransportPluginHelper * helper,
 	udp->aip = NULL;
 	udp->messages = NULL;
 	udp->messages_cnt = 0;
+	if((udp->pool = appmessage_pool_new(POOL_SIZE)) == NULL)
+	{
+		object_delete(udp);
+		return NULL;
+	}
 	switch((udp->mode) = mode)
 	{
 		case ATM_CLIENT:
@@ -185,7 +201,7 @@ static int _init_client(UDP * udp, char const * name, int domain)
 {
 	memset(&udp->u, 0, sizeof(udp->u));
 	/* obtain the remote address */
-	if((udp->ai = _init_address(name, domain, 0)) == NULL)
+	if((udp->ai = _init_address(udp->helper, name, domain, 0)) == NULL)
 		return -1;
 	for(udp->aip = udp->ai; udp->aip != NULL; udp->aip = udp->aip->ai_next)
 	{
@@ -199,7 +215,7 @@ static int _init_client(UDP * udp, char const * name, int domain)
 	}
 	if(udp->aip == NULL)
 	{
-		freeaddrinfo(udp->ai);
+		_destroy_address(udp->helper, udp->ai);
 		udp->ai = NULL;
 		return -1;
 	}
@@ -211,7 +227,8 @@ static int _init_server(UDP * udp, char const * name, int domain)
 	udp->u.server.clients = NULL;
 	udp->u.server.clients_cnt = 0;
 	/* obtain the local address */
-	if((udp->ai = _init_address(name, domain, AI_PASSIVE)) == NULL)
+	if((udp->ai = _init_address(udp->helper, name, domain, AI_PASSIVE))
+			== NULL)
 		return -1;
 	for(udp->aip = udp->ai; udp->aip != NULL; udp->aip = udp->aip->ai_next)
 	{
@@ -219,7 +236,9 @@ static int _init_server(UDP * udp, char const * name, int domain)
 		if(_init_socket(udp) != 0)
 			continue;
 		/* accept incoming messages */
-		if(bind(udp->fd, udp->aip->ai_addr, udp->aip->ai_addrlen) != 0)
+		if(_share_socket(udp->helper, udp->fd) != 0
+				|| bind(udp->fd, udp->aip->ai_addr,
+					udp->aip->ai_addrlen) != 0)
 		{
 			_udp_error("bind");
 			close(udp->fd);
@@ -233,7 +252,7 @@ static int _init_server(UDP * udp, char const * name, int domain)
 	}
 	if(udp->aip == NULL)
 	{
-		freeaddrinfo(udp->ai);
+		_destroy_address(udp->helper, udp->ai);
 		udp->ai = NULL;
 		return -1;
 	}
@@ -275,8 +294,9 @@ static void _udp_destroy(UDP * udp)
 	if(udp->fd >= 0)
 		close(udp->fd);
 	free(udp->messages);
-	if(udp->ai != NULL)
-		freeaddrinfo(udp->ai);
+	_destroy_address(udp->helper, udp->ai);
+	if(udp->pool != NULL)
+		appmessage_pool_delete(udp->pool);
 	object_delete(udp);
 }
 
@@ -300,21 +320,16 @@ static int _udp_client_send(UDP * udp, AppTransportClient * client,
 		AppMessage * message)
 {
 	int ret;
-	size_t i;
+	AppTransportPluginHelper * helper = udp->helper;
 	UDPClient * c;
 	Buffer * buffer;
 #ifdef DEBUG
 	struct sockaddr_in * sa;
 #endif
 
-	/* lookup the client */
-	for(i = 0; i < udp->u.server.clients_cnt; i++)
-	{
-		c = udp->u.server.clients[i];
-		if(c->client == client)
-			break;
-	}
-	if(i == udp->u.server.clients_cnt)
+	/* obtain the address of the client */
+	if((c = helper->client_get_data(helper->transport, client)) == NULL
+			|| c->client != client)
 		return -error_set_code(-ENOENT, "%s", "Unknown client");
 	/* send the message */
 	if((buffer = buffer_new(0, NULL)) == NULL)
@@ -344,6 +359,23 @@ static int _udp_client_send(UDP * udp, AppTransportClient * client,
 }
 
 
+/* udp_client_get_name */
+static int _udp_client_get_name(UDP * udp, AppTransportClient * client,
+		char * name, size_t size)
+{
+	AppTransportPluginHelper * helper = udp->helper;
+	UDPClient * c;
+
+	if(udp->mode != ATM_SERVER)
+		return -error_set_code(1, "%s", "Not a server");
+	if((c = helper->client_get_data(helper->transport, client)) == NULL
+			|| c->client != client)
+		return -error_set_code(-ENOENT, "%s", "Unknown client");
+	return _lookup_name(c->sa, c->sa_len, NI_NUMERICSERV | NI_DGRAM, name,
+			size);
+}
+
+
 /* udp_send */
 static int _udp_send(UDP * udp, AppMessage * message)
 {
@@ -408,12 +440,11 @@ static int _udp_client_init(UDPClient * client, struct sockaddr * sa,
 
 	if((client->sa = malloc(sa_len)) == NULL)
 		return -1;
-	/* XXX may not be instant */
+	memcpy(client->sa, sa, sa_len);
+	client->sa_len = sa_len;
+	/* the name is resolved later if necessary */
 	if(getnameinfo(client->sa, client->sa_len, host, sizeof(host), NULL, 0,
-				NI_NAMEREQD | flags) != 0
-			&& getnameinfo(client->sa, client->sa_len, host,
-				sizeof(host), NULL, 0, NI_NUMERICHOST | flags)
-			!= 0)
+				NI_NUMERICHOST | flags) != 0)
 		name = NULL;
 	if((client->client = helper->client_new(helper->transport, name))
 			== NULL)
@@ -421,10 +452,9 @@ static int _udp_client_init(UDPClient * client, struct sockaddr * sa,
 		free(client->sa);
 		return -1;
 	}
+	helper->client_set_data(helper->transport, client->client, client);
 	/* XXX we can ignore errors here */
 	client->time = time(NULL);
-	memcpy(client->sa, sa, sa_len);
-	client->sa_len = sa_len;
 	return 0;
 }
 
@@ -442,7 +472,8 @@ static int _udp_callback_read(int fd, UDP * udp)
 	ssize_t ssize;
 	struct sockaddr * sa;
 	socklen_t sa_len = udp->aip->ai_addrlen;
-	Buffer * buffer;
+	char * data;
+	AppMessageFrame * frame;
 	AppMessage * message = NULL;
 
 #ifdef DEBUG
@@ -465,13 +496,22 @@ static int _udp_callback_read(int fd, UDP * udp)
 #ifdef DEBUG
 	fprintf(stderr, "DEBUG: %s() ssize=%ld\n", __func__, ssize);
 #endif
-	if((buffer = buffer_new(ssize, buf)) == NULL)
+	/* the message will borrow from this copy of the datagram */
+	if((data = malloc(ssize)) == NULL && ssize > 0)
 	{
 		free(sa);
 		return 0;
 	}
-	message = appmessage_new_deserialize(buffer);
-	buffer_delete(buffer);
+	memcpy(data, buf, ssize);
+	if((frame = appmessage_frame_new(data, ssize)) == NULL)
+	{
+		free(data);
+		free(sa);
+		return 0;
+	}
+	message = appmessage_new_deserialize_pool(udp->pool, frame, 0,
+			ssize);
+	appmessage_frame_unref(frame);
 	if(message == NULL)
 	{
 		/* FIXME report error */
@@ -15,14 +15,160 @@
 
 
 
+#include <stdlib.h>
 #include <string.h>
 #include <System.h>
 #include "App/appmessage.h"
+#include "../src/appmessage.h"
 
 
-/* public */
-/* main */
-int main(int argc, char * argv[])
+/* prototypes */
+static int _appmessage_acknowledgements(void);
+static int _appmessage_batch(void);
+static int _appmessage_call(void);
+static int _appmessage_deserialize(Buffer * buffer);
+static int _appmessage_handshake(void);
+static int _appmessage_id(void);
+static int _appmessage_pool(Buffer * buffer);
+static int _appmessage_reply(void);
+static int _appmessage_serialize(void);
+
+
+/* functions */
+/* appmessage_acknowledgements */
+static int _appmessage_acknowledgements(void)
+{
+	/* ranges of IDs are flagged in the type and follow it */
+	const char expected[] = { AMT_ACKNOWLEDGEMENT | 0x20,
+		0x00, 0x00, 0x00, 0x02,
+		0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x03,
+		0x00, 0x00, 0x00, 0x05, 0x00, 0x00, 0x00, 0x05,
+		0x00, 0x00, 0x00, 0x00 };
+	const AppMessageID acks[] = { 1, 3, 5, 5 };
+	const AppMessageID acks64[] = { 0x100000000ULL, 0x100000002ULL };
+	int ret = 0;
+	AppMessage * message;
+	Buffer * buffer;
+	AppMessageID const * p;
+
+	if((buffer = buffer_new(0, NULL)) == NULL)
+		return 47;
+	/* cumulative acknowledgement */
+	if((message = appmessage_new_acknowledgement(0)) == NULL
+			|| appmessage_set_acknowledgements(message, acks, 2)
+			!= 0)
+		ret = 48;
+	else if(appmessage_serialize(message, buffer) != 0
+			|| buffer_get_size(buffer) != sizeof(expected)
+			|| memcmp(buffer_get_data(buffer), expected,
+				sizeof(expected)) != 0)
+		ret = 49;
+	if(message != NULL)
+		appmessage_delete(message);
+	if(ret == 0 && ((message = appmessage_new_deserialize(buffer)) == NULL
+				|| appmessage_get_id(message) != 0
+				|| appmessage_get_acknowledgements(message, &p)
+				!= 2 || memcmp(p, acks, sizeof(acks)) != 0))
+		ret = 50;
+	if(ret == 0)
+		appmessage_delete(message);
+	/* piggybacked on a call with 64-bit IDs */
+	if(ret == 0 && ((message = appmessage_new_call("test", NULL, 0))
+				== NULL || appmessage_set_acknowledgements(
+					message, acks64, 1) != 0))
+		ret = 51;
+	else if(ret == 0)
+	{
+		appmessage_set_id(message, 7);
+		if(appmessage_serialize(message, buffer) != 0)
+			ret = 52;
+		appmessage_delete(message);
+	}
+	if(ret == 0 && ((message = appmessage_new_deserialize(buffer)) == NULL
+				|| appmessage_get_type(message) != AMT_CALL
+				|| appmessage_get_id(message) != 7
+				|| strcmp(appmessage_get_method(message),
+					"test") != 0
+				|| appmessage_get_acknowledgements(message, &p)
+				!= 1 || memcmp(p, acks64, sizeof(acks64)) != 0))
+		ret = 53;
+	if(ret == 0)
+	{
+		/* the acknowledgements can be removed */
+		if(appmessage_set_acknowledgements(message, NULL, 0) != 0
+				|| appmessage_serialize(message, buffer) != 0
+				|| buffer_get_size(buffer) != 1 + 4 + 5)
+			ret = 54;
+		appmessage_delete(message);
+	}
+	buffer_delete(buffer);
+	return ret;
+}
+
+
+/* appmessage_batch */
+static int _appmessage_batch(void)
+{
+	int ret = 0;
+	AppMessage * message;
+	AppMessage * call;
+	Buffer * buffer;
+	String const * method;
+	AppMessageMethodID id;
+
+	if((message = appmessage_new_batch()) == NULL)
+		return 33;
+	if((call = appmessage_new_call("first", NULL, 0)) == NULL
+			|| appmessage_batch_append(message, call) != 0)
+		ret = 34;
+	else if((call = appmessage_new_call("second", NULL, 0)) == NULL
+			|| appmessage_set_method_id(call, 2) != 0
+			|| appmessage_batch_append(message, call) != 0)
+		ret = 34;
+	else if((call = appmessage_new_call("third", NULL, 0)) == NULL)
+		ret = 34;
+	else
+	{
+		/* flagged with a 64-bit ID */
+		appmessage_set_id(call, 0x100000003ULL);
+		if(appmessage_batch_append(message, call) != 0)
+			ret = 34;
+	}
+	if((buffer = buffer_new(0, NULL)) == NULL)
+		ret = 35;
+	else if(ret == 0 && appmessage_serialize(message, buffer) != 0)
+		ret = 35;
+	appmessage_delete(message);
+	if(ret != 0)
+	{
+		if(buffer != NULL)
+			buffer_delete(buffer);
+		return ret;
+	}
+	/* the calls are obtained in order */
+	if((message = appmessage_new_deserialize(buffer)) == NULL
+			|| appmessage_get_type(message) != AMT_BATCH
+			|| appmessage_get_batch_messages_count(message) != 3)
+		ret = 36;
+	else if((call = appmessage_get_batch_message(message, 0)) == NULL
+			|| (method = appmessage_get_method(call)) == NULL
+			|| strcmp(method, "first") != 0
+			|| (call = appmessage_get_batch_message(message, 1))
+			== NULL
+			|| appmessage_get_method_id(call, &id) != 0 || id != 2
+			|| (call = appmessage_get_batch_message(message, 2))
+			== NULL
+			|| appmessage_get_id(call) != 0x100000003ULL)
+		ret = 37;
+	if(message != NULL)
+		appmessage_delete(message);
+	buffer_delete(buffer);
+	return ret;
+}
+
+
+/* appmessage_call */
+static int _appmessage_call(void)
 {
 	int ret = 0;
 	AppMessage * message;
@@ -55,3 +201,321 @@ int main(int argc, char * argv[])
 		appmessage_delete(message);
 	return ret;
 }
+
+
+/* appmessage_deserialize */
+static int _appmessage_deserialize(Buffer * buffer)
+{
+	int ret = 0;
+	AppMessage * message;
+	VariableType type;
+	void const * data;
+	size_t size;
+	Variable * v;
+	int32_t i32;
+
+	if((message = appmessage_new_deserialize(buffer)) == NULL)
+		return 14;
+	if(appmessage_get_arguments_count(message) != 2)
+		ret = 15;
+	/* the string is only a view on the message */
+	else if(appmessage_get_argument_data(message, 1, &type, &data, &size)
+			!= 0 || type != VT_STRING || size != 6
+			|| memcmp(data, "string", size) != 0)
+		ret = 16;
+	else if((v = appmessage_get_argument(message, 0)) == NULL
+			|| variable_get_as(v, VT_INT32, &i32, NULL) != 0
+			|| i32 != -42)
+		ret = 17;
+	else if((v = appmessage_get_argument(message, 1)) == NULL
+			|| variable_get_type(v) != VT_STRING)
+		ret = 18;
+	appmessage_delete(message);
+	return ret;
+}
+
+
+/* appmessage_handshake */
+static int _appmessage_handshake(void)
+{
+	/* expected encoding of a call to the second method, by ID */
+	const char expected[] = { AMT_CALL | 0x80, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x01 };
+	String const * methods[] = { "test", "other" };
+	int ret = 0;
+	AppMessage * message;
+	Buffer * buffer;
+	String const * method;
+	AppMessageMethodID id;
+
+	if((buffer = buffer_new(0, NULL)) == NULL)
+		return 24;
+	/* the server advertises its methods */
+	if((message = appmessage_new_handshake(methods, 2)) == NULL)
+		ret = 25;
+	else if(appmessage_serialize(message, buffer) != 0)
+		ret = 26;
+	if(message != NULL)
+		appmessage_delete(message);
+	if(ret == 0 && ((message = appmessage_new_deserialize(buffer)) == NULL
+				|| appmessage_get_type(message)
+				!= AMT_HANDSHAKE))
+		ret = 27;
+	else if(ret == 0)
+	{
+		if(appmessage_get_handshake_methods_count(message) != 2
+				|| (method = appmessage_get_handshake_method(
+						message, 1)) == NULL
+				|| strcmp(method, "other") != 0)
+			ret = 28;
+		appmessage_delete(message);
+	}
+	if(ret != 0)
+	{
+		buffer_delete(buffer);
+		return ret;
+	}
+	/* the client calls them by ID */
+	if((message = appmessage_new_call("other", NULL, 0)) == NULL)
+		ret = 29;
+	else if(appmessage_set_method_id(message, 1) != 0
+			|| appmessage_serialize(message, buffer) != 0
+			|| buffer_get_size(buffer) != sizeof(expected)
+			|| memcmp(buffer_get_data(buffer), expected,
+				sizeof(expected)) != 0)
+		ret = 30;
+	if(message != NULL)
+		appmessage_delete(message);
+	if(ret == 0 && (message = appmessage_new_deserialize(buffer)) == NULL)
+		ret = 31;
+	else if(ret == 0)
+	{
+		if(appmessage_get_type(message) != AMT_CALL
+				|| appmessage_get_method(message) != NULL
+				|| appmessage_get_method_id(message, &id) != 0
+				|| id != 1)
+			ret = 32;
+		appmessage_delete(message);
+	}
+	buffer_delete(buffer);
+	return ret;
+}
+
+
+/* appmessage_id */
+static int _appmessage_id(void)
+{
+	/* IDs larger than 32 bits are flagged in the type */
+	const char expected[] = { AMT_ACKNOWLEDGEMENT | 0x40, 0x00, 0x00, 0x00,
+		0x01, 0x00, 0x00, 0x00, 0x02 };
+	const AppMessageID ids[] = { 1, 0xffffffff, 0x100000002ULL };
+	int ret = 0;
+	AppMessage * message;
+	Buffer * buffer;
+	size_t i;
+
+	if((buffer = buffer_new(0, NULL)) == NULL)
+		return 38;
+	for(i = 0; ret == 0 && i < sizeof(ids) / sizeof(*ids); i++)
+	{
+		if((message = appmessage_new_acknowledgement(ids[i])) == NULL)
+		{
+			ret = 39;
+			break;
+		}
+		if(appmessage_serialize(message, buffer) != 0
+				|| buffer_get_size(buffer)
+				!= ((ids[i] > 0xffffffff) ? 9 : 5))
+			ret = 40;
+		appmessage_delete(message);
+		if(ret != 0)
+			break;
+		if((message = appmessage_new_deserialize(buffer)) == NULL)
+			ret = 41;
+		else
+		{
+			if(appmessage_get_id(message) != ids[i])
+				ret = 41;
+			appmessage_delete(message);
+		}
+	}
+	if(ret == 0 && memcmp(buffer_get_data(buffer), expected,
+				sizeof(expected)) != 0)
+		ret = 42;
+	buffer_delete(buffer);
+	return ret;
+}
+
+
+/* appmessage_pool */
+static int _appmessage_pool(Buffer * buffer)
+{
+	int ret = 0;
+	AppMessagePool * pool;
+	size_t size = buffer_get_size(buffer);
+	char * data;
+	AppMessageFrame * frame;
+	AppMessage * message;
+	size_t i;
+	AppMessagePoolStats stats;
+
+	if((pool = appmessage_pool_new(1)) == NULL)
+		return 19;
+	if((data = malloc(size)) == NULL
+			|| (frame = appmessage_frame_new(data, size)) == NULL)
+	{
+		free(data);
+		appmessage_pool_delete(pool);
+		return 20;
+	}
+	memcpy(data, buffer_get_data(buffer), size);
+	/* the second message should be recycled from the first */
+	for(i = 0; i < 2; i++)
+	{
+		if((message = appmessage_new_deserialize_pool(pool, frame, 0,
+						size)) == NULL)
+			break;
+		if(appmessage_get_arguments_count(message) != 2)
+			ret = 21;
+		appmessage_delete(message);
+	}
+	appmessage_frame_unref(frame);
+	appmessage_pool_get_stats(pool, &stats);
+	appmessage_pool_delete(pool);
+	if(i != 2)
+		return 22;
+	if(stats.hits != 1 || stats.misses != 1 || stats.recycled != 2)
+		return 23;
+	return ret;
+}
+
+
+/* appmessage_reply */
+static int _appmessage_reply(void)
+{
+	int ret = 0;
+	AppMessage * message;
+	Variable * result;
+	Variable * args[2];
+	Buffer * buffer;
+	Variable * v;
+	int32_t i32 = 0;
+
+	/* the result and the AICD_{,IN_}OUT arguments */
+	result = variable_new(VT_INT32, 42);
+	args[0] = variable_new(VT_STRING, "out");
+	args[1] = variable_new(VT_UINT8, 7);
+	if(result == NULL || args[0] == NULL || args[1] == NULL
+			|| (message = appmessage_new_reply(3, 0, result, args,
+					2)) == NULL)
+		ret = 43;
+	if(result != NULL)
+		variable_delete(result);
+	if(args[0] != NULL)
+		variable_delete(args[0]);
+	if(args[1] != NULL)
+		variable_delete(args[1]);
+	if(ret != 0)
+		return ret;
+	if((buffer = buffer_new(0, NULL)) == NULL
+			|| appmessage_serialize(message, buffer) != 0)
+		ret = 44;
+	appmessage_delete(message);
+	if(ret != 0)
+	{
+		if(buffer != NULL)
+			buffer_delete(buffer);
+		return ret;
+	}
+	if((message = appmessage_new_deserialize(buffer)) == NULL
+			|| appmessage_get_type(message) != AMT_REPLY
+			|| appmessage_get_id(message) != 3
+			|| appmessage_get_reply_code(message) != 0
+			|| appmessage_get_arguments_count(message) != 2)
+		ret = 45;
+	else if((v = appmessage_get_reply_result(message)) == NULL
+			|| variable_get_as(v, VT_INT32, &i32, NULL) != 0
+			|| i32 != 42
+			|| (v = appmessage_get_argument(message, 0)) == NULL
+			|| variable_get_type(v) != VT_STRING
+			|| (v = appmessage_get_argument(message, 1)) == NULL
+			|| variable_get_type(v) != VT_UINT8)
+		ret = 46;
+	if(message != NULL)
+		appmessage_delete(message);
+	buffer_delete(buffer);
+	return ret;
+}
+
+
+/* appmessage_serialize */
+static int _appmessage_serialize(void)
+{
+	/* expected encoding of test(INT32 -42, STRING "string") */
+	const char expected[] = { AMT_CALL, 0x00, 0x00, 0x00, 0x00,
+		't', 'e', 's', 't', '\0',
+		VT_INT32, 0xff, 0xff, 0xff, 0xd6,
+		VT_STRING, 's', 't', 'r', 'i', 'n', 'g', '\0' };
+	int ret = 0;
+	AppMessageCallArgument args[2];
+	size_t s;
+	AppMessage * message;
+	Buffer * buffer = NULL;
+	VariableType type;
+	void const * data;
+
+	/* obtain the arguments from their own encoding */
+	args[0].direction = AMCD_IN;
+	s = 4;
+	args[0].arg = variable_new_deserialize_type(VT_INT32, &s,
+			&expected[11]);
+	args[1].direction = AMCD_IN;
+	s = 7;
+	args[1].arg = variable_new_deserialize_type(VT_STRING, &s,
+			&expected[16]);
+	message = (args[0].arg != NULL && args[1].arg != NULL)
+		? appmessage_new_call("test", args, 2) : NULL;
+	if(args[0].arg != NULL)
+		variable_delete(args[0].arg);
+	if(args[1].arg != NULL)
+		variable_delete(args[1].arg);
+	if(message == NULL)
+		return 9;
+	/* the string is copied once, and serialized from there */
+	if(appmessage_get_argument_data(message, 1, &type, &data, &s) != 0
+			|| type != VT_STRING || s != 6
+			|| memcmp(data, "string", s) != 0)
+		ret = 13;
+	else if((buffer = buffer_new(0, NULL)) == NULL)
+		ret = 10;
+	else if(appmessage_serialize(message, buffer) != 0)
+		ret = 11;
+	else if(buffer_get_size(buffer) != sizeof(expected)
+			|| memcmp(buffer_get_data(buffer), expected,
+				sizeof(expected)) != 0)
+		ret = 12;
+	else if((ret = _appmessage_deserialize(buffer)) == 0)
+		ret = _appmessage_pool(buffer);
+	if(buffer != NULL)
+		buffer_delete(buffer);
+	appmessage_delete(message);
+	return ret;
+}
+
+
+/* public */
+/* main */
+int main(int argc, char * argv[])
+{
+	int ret;
+
+	if((ret = _appmessage_call()) != 0
+			|| (ret = _appmessage_serialize()) != 0
+			|| (ret = _appmessage_handshake()) != 0
+			|| (ret = _appmessage_id()) != 0
+			|| (ret = _appmessage_reply()) != 0
+			|| (ret = _appmessage_batch()) != 0
+			|| (ret = _appmessage_acknowledgements()) != 0)
+		return ret;
+	return 0;
+}
@@ -16,46 +16,246 @@
 
 
 #include <unistd.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <System/error.h>
+#include "App/appclient.h"
 #include "App/appserver.h"
+#include "Calls.h"
 #include "Dummy.h"
+#include "Test.h"
+
+#ifndef PROGNAME
+# define PROGNAME	"appserver"
+#endif
 
 
 /* private */
+/* prototypes */
+static int _appserver_calls(AppServerOptions options, char const * app,
+		char const * name, unsigned int calls);
+
+static int _usage(void);
+
+
 /* functions */
+/* appserver_calls */
+static int _appserver_calls(AppServerOptions options, char const * app,
+		char const * name, unsigned int calls)
+{
+	int ret = 0;
+	Event * event;
+	AppServer * appserver;
+	AppClient * appclient;
+	unsigned int i;
+	int32_t i32;
+	int32_t out;
+	int32_t inout;
+	int32_t r32;
+	bool res;
+	Buffer * buffer;
+	uint32_t u32;
+
+	/* the client and the server share the event loop */
+	if((event = event_new()) == NULL)
+		return -1;
+	if((appserver = appserver_new_event(NULL, options, app, name, event))
+			== NULL)
+	{
+		event_delete(event);
+		return -1;
+	}
+	if((appclient = appclient_new_event(NULL, app, name, event)) == NULL)
+	{
+		appserver_delete(appserver);
+		event_delete(event);
+		return -1;
+	}
+	for(i = 0; i < calls; i++)
+	{
+		/* AICD_IN_OUT */
+		i32 = i;
+		res = false;
+		if((ret = appclient_call(appclient, (void **)&res, "Increment",
+						&i32)) != 0)
+			break;
+		if(res != true || i32 != (int32_t)i + 1)
+		{
+			ret = -error_set_code(1, "%s", "Increment: Invalid reply");
+			break;
+		}
+		/* AICD_IN, AICD_OUT and AICD_IN_OUT */
+		out = -1;
+		inout = i * 2;
+		r32 = -1;
+		if((ret = appclient_call(appclient, (void **)&r32, "Exchange",
+						(int32_t)i, &out, &inout)) != 0)
+			break;
+		if(r32 != (int32_t)i + 1 || out != (int32_t)i * 2
+				|| inout != (int32_t)i)
+		{
+			ret = -error_set_code(1, "%s", "Exchange: Invalid reply");
+			break;
+		}
+		/* STRING and BUFFER */
+		if((buffer = buffer_new(i, NULL)) == NULL)
+		{
+			ret = -1;
+			break;
+		}
+		u32 = 0;
+		ret = appclient_call(appclient, (void **)&u32, "Length",
+				"string", buffer);
+		buffer_delete(buffer);
+		if(ret != 0)
+			break;
+		if(u32 != 6 + i)
+		{
+			ret = -error_set_code(1, "%s", "Length: Invalid reply");
+			break;
+		}
+	}
+	appclient_delete(appclient);
+	appserver_delete(appserver);
+	event_delete(event);
+	return ret;
+}
+
+
 /* usage */
 static int _usage(void)
 {
-	fputs("Usage: appserver [-a app][-n name]\n", stderr);
+	fputs("Usage: " PROGNAME " [-a app][-n name][-c calls][-t threads]"
+			"[-o][-w workers]\n", stderr);
 	return 1;
 }
 
 
 /* public */
+/* functions */
+/* Increment */
+bool Calls_Increment(App * app, AppServerClient * client, int32_t * i32)
+{
+	(*i32)++;
+	return true;
+}
+
+
+/* Exchange */
+int32_t Calls_Exchange(App * app, AppServerClient * client, int32_t i32,
+		int32_t * out, int32_t * inout)
+{
+	*out = *inout;
+	*inout = i32;
+	return i32 + 1;
+}
+
+
+/* Length */
+uint32_t Calls_Length(App * app, AppServerClient * client,
+		String const * string, Buffer const * buffer)
+{
+	return string_get_length(string) + buffer_get_size(buffer);
+}
+
+
+/* Test */
+void Test_Test(App * app, AppServerClient * client, int32_t i32)
+{
+}
+
+
+/* Test2 */
+bool Test_Test2(App * app, AppServerClient * client, int32_t * i32)
+{
+	(*i32)++;
+	return true;
+}
+
+
+/* Test3 */
+String const * Test_Test3(App * app, AppServerClient * client)
+{
+	return "Test3";
+}
+
+
+/* Test4 */
+void Test_Test4(App * app, AppServerClient * client, int8_t i8,
+		uint16_t u16)
+{
+}
+
+
+/* Test5 */
+void Test_Test5(App * app, AppServerClient * client, int8_t const * i8,
+		uint16_t const * u16)
+{
+}
+
+
+/* Test6 */
+String const ** Test_Test6(App * app, AppServerClient * client)
+{
+	return NULL;
+}
+
+
+/* Test7 */
+void Test_Test7(App * app, AppServerClient * client, int32_t i32)
+{
+}
+
+
 /* main */
 int main(int argc, char * argv[])
 {
 	int o;
 	char const * app = NULL;
 	char const * name = NULL;
+	unsigned int calls = 0;
+	AppServerOptions options = 0;
 	AppServer * appserver;
 
-	while((o = getopt(argc, argv, "a:n:")) != -1)
+	while((o = getopt(argc, argv, "a:c:n:ot:w:")) != -1)
 		switch(o)
 		{
 			case 'a':
 				app = optarg;
 				break;
+			case 'c':
+				calls = strtoul(optarg, NULL, 10);
+				break;
 			case 'n':
 				name = optarg;
 				break;
+			case 'o':
+				options |= ASO_ORDERED;
+				break;
+			case 't':
+				options |= ASO_THREADS(strtoul(optarg, NULL,
+							10));
+				break;
+			case 'w':
+				options |= ASO_WORKERS(strtoul(optarg, NULL,
+							10));
+				break;
 			default:
 				return _usage();
 		}
-	if((appserver = appserver_new(NULL, 0, app, name)) == NULL)
+	if(calls > 0)
+	{
+		/* call the server from the same process */
+		if(_appserver_calls(options, app, name, calls) != 0)
+		{
+			error_print(PROGNAME);
+			return 2;
+		}
+		return 0;
+	}
+	if((appserver = appserver_new(NULL, options, app, name)) == NULL)
 	{
-		error_print("appserver");
+		error_print(PROGNAME);
 		return 2;
 	}
 	appserver_delete(appserver);
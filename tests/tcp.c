@@ -0,0 +1,898 @@
+/* $Id$ */
+/* Copyright (c) 2025 Pierre Pronchery <khorben@defora.org> */
+/* This file is part of DeforaOS System libApp */
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <netdb.h>
+#include <System.h>
+#include "App.h"
+#include "../src/appmessage.h"
+
+#ifndef PROGNAME
+# define PROGNAME	"tcp"
+#endif
+
+
+/* private */
+/* constants */
+/* frame headers (see src/transport/tcp.c) */
+#define TCP_FRAME_LEGACY_SIZE	4
+#define TCP_FRAME_HEADER_SIZE	8
+#define TCP_FRAME_MARKER	0x80
+#define TCP_FRAME_VERSION	1
+
+
+/* types */
+struct _AppTransportClient
+{
+	void * data;
+};
+
+typedef struct _AppTransport
+{
+	AppTransportPluginHelper helper;
+	AppTransportPluginDefinition * plugind;
+	AppTransportPlugin * server;
+	AppTransportClient * client;
+	unsigned int received;
+} Transport;
+
+
+/* prototypes */
+static int _tcp(char const * protocol, char const * name);
+
+/* tests */
+static int _tcp_frames(Transport * transport, char const * name);
+static int _tcp_legacy(Transport * transport, char const * name);
+static int _tcp_negotiate(Transport * transport, char const * name);
+static int _tcp_negotiate_client(Transport * transport, char const * name);
+static int _tcp_negotiate_server(Transport * transport, char const * name);
+static int _tcp_oversized(Transport * transport, char const * name);
+static int _tcp_partial(Transport * transport, char const * name);
+static int _tcp_split(Transport * transport, char const * name);
+
+/* useful */
+static int _tcp_connect(char const * name);
+static int _tcp_listen(char const * name, char ** address);
+static unsigned char * _tcp_frame(AppMessage * message, unsigned int version,
+		size_t * size);
+static int _tcp_read(Transport * transport, int fd, unsigned char * buf,
+		size_t size);
+static int _tcp_read_message(Transport * transport, int fd,
+		unsigned int * version, AppMessage ** message);
+static void _tcp_run(Transport * transport, unsigned int ms);
+static int _tcp_wait(Transport * transport, unsigned int received);
+
+/* helpers */
+static int _tcp_helper_receive(AppTransport * transport, AppMessage * message);
+
+static AppTransportClient * _tcp_helper_client_new(AppTransport * transport,
+		char const * name);
+static void _tcp_helper_client_delete(AppTransport * transport,
+		AppTransportClient * client);
+static int _tcp_helper_client_receive(AppTransport * transport,
+		AppTransportClient * client, AppMessage * message);
+static void * _tcp_helper_client_get_data(AppTransport * transport,
+		AppTransportClient * client);
+static void _tcp_helper_client_set_data(AppTransport * transport,
+		AppTransportClient * client, void * data);
+static int _tcp_helper_lookup(AppTransport * transport, char const * hostname,
+		char const * servname, struct addrinfo const * hints,
+		struct addrinfo ** res);
+static void _tcp_helper_lookup_free(AppTransport * transport,
+		struct addrinfo * ai);
+
+/* callbacks */
+static int _tcp_callback_timeout(void * data);
+
+static int _usage(void);
+
+
+/* functions */
+/* tcp */
+static int _tcp(char const * protocol, char const * name)
+{
+	int ret;
+	char * cwd;
+	char const * p;
+	Plugin * plugin;
+	Transport transport;
+	AppTransportPluginHelper * helper = &transport.helper;
+
+	/* load the transport plug-in */
+	if((cwd = getcwd(NULL, 0)) == NULL)
+		return error_set_print(PROGNAME, 2, "%s", strerror(errno));
+	if((p = getenv("OBJDIR")) != NULL)
+		plugin = plugin_new(p, "../src", "transport", protocol);
+	else
+		plugin = plugin_new(cwd, "../src", "transport", protocol);
+	free(cwd);
+	if(plugin == NULL)
+		return error_print(PROGNAME);
+	if((transport.plugind = plugin_lookup(plugin, "transport")) == NULL)
+	{
+		plugin_delete(plugin);
+		return error_print(PROGNAME);
+	}
+	transport.client = NULL;
+	transport.received = 0;
+	/* initialize the helper */
+	memset(helper, 0, sizeof(*helper));
+	helper->transport = &transport;
+	helper->receive = _tcp_helper_receive;
+	helper->client_new = _tcp_helper_client_new;
+	helper->client_delete = _tcp_helper_client_delete;
+	helper->client_receive = _tcp_helper_client_receive;
+	helper->client_get_data = _tcp_helper_client_get_data;
+	helper->client_set_data = _tcp_helper_client_set_data;
+	helper->lookup = _tcp_helper_lookup;
+	helper->lookup_free = _tcp_helper_lookup_free;
+	/* create the server */
+	if((helper->event = event_new()) == NULL
+			|| (transport.server = transport.plugind->init(helper,
+					ATM_SERVER, name)) == NULL)
+	{
+		if(helper->event != NULL)
+			event_delete(helper->event);
+		plugin_delete(plugin);
+		return error_print(PROGNAME);
+	}
+	/* talk to the server directly */
+	if((ret = _tcp_legacy(&transport, name)) != 0
+			|| (ret = _tcp_frames(&transport, name)) != 0
+			|| (ret = _tcp_split(&transport, name)) != 0
+			|| (ret = _tcp_oversized(&transport, name)) != 0
+			|| (ret = _tcp_partial(&transport, name)) != 0
+			|| (ret = _tcp_negotiate(&transport, name)) != 0)
+		error_print(PROGNAME);
+	transport.plugind->destroy(transport.server);
+	event_delete(helper->event);
+	plugin_delete(plugin);
+	return ret;
+}
+
+
+/* tests */
+/* tcp_frames */
+static int _tcp_frames(Transport * transport, char const * name)
+{
+	int ret = 0;
+	int fd;
+	AppMessage * message;
+	unsigned char * frame;
+	size_t size;
+	unsigned char * frames;
+	size_t i;
+
+	if((fd = _tcp_connect(name)) < 0)
+		return -1;
+	if((message = appmessage_new_callv("hello", -1)) == NULL)
+	{
+		close(fd);
+		return -1;
+	}
+	frame = _tcp_frame(message, 0, &size);
+	appmessage_delete(message);
+	if(frame == NULL || (frames = malloc(size * 3)) == NULL)
+	{
+		free(frame);
+		close(fd);
+		return -1;
+	}
+	/* several frames are received at once */
+	for(i = 0; i < 3; i++)
+		memcpy(&frames[size * i], frame, size);
+	if(write(fd, frames, size * 3) != (ssize_t)size * 3)
+		ret = -error_set_code(-errno, "%s", strerror(errno));
+	else
+		ret = _tcp_wait(transport, 3);
+	free(frames);
+	free(frame);
+	close(fd);
+	_tcp_run(transport, 10);
+	return ret;
+}
+
+
+/* tcp_legacy */
+static int _tcp_legacy(Transport * transport, char const * name)
+{
+	int ret = 0;
+	int fd;
+	AppMessage * message;
+	unsigned char * frame;
+	size_t size;
+	unsigned int version;
+
+	/* legacy clients only prefix the length */
+	if((fd = _tcp_connect(name)) < 0)
+		return -1;
+	if((message = appmessage_new_callv("hello", -1)) == NULL)
+	{
+		close(fd);
+		return -1;
+	}
+	appmessage_set_id(message, 1);
+	frame = _tcp_frame(message, 0, &size);
+	appmessage_delete(message);
+	if(frame == NULL)
+		ret = -1;
+	else if(write(fd, frame, size) != (ssize_t)size)
+		ret = -error_set_code(-errno, "%s", strerror(errno));
+	free(frame);
+	/* they are acknowledged with legacy frames */
+	if(ret == 0 && (ret = _tcp_wait(transport, 1)) == 0
+			&& (ret = _tcp_read_message(transport, fd, &version,
+					&message)) == 0)
+	{
+		if(version != 0)
+			ret = -error_set_code(1, "%s", "Versioned reply");
+		else if(appmessage_get_type(message) != AMT_ACKNOWLEDGEMENT
+				|| appmessage_get_id(message) != 1)
+			ret = -error_set_code(1, "%s", "Invalid reply");
+		appmessage_delete(message);
+	}
+	close(fd);
+	_tcp_run(transport, 10);
+	return ret;
+}
+
+
+/* tcp_negotiate */
+static int _tcp_negotiate(Transport * transport, char const * name)
+{
+	/* clients announce themselves with an empty acknowledgement */
+	if(_tcp_negotiate_server(transport, name) != 0
+			|| _tcp_negotiate_client(transport, name) != 0)
+		return -1;
+	return 0;
+}
+
+static int _tcp_negotiate_client(Transport * transport, char const * name)
+{
+	int ret = 0;
+	int listener;
+	char * address;
+	AppTransportPlugin * client;
+	int fd;
+	AppMessage * message;
+	AppMessage * received;
+	unsigned char * frame = NULL;
+	size_t size;
+	unsigned int version;
+	AppMessageID i;
+
+	/* talk to the client directly */
+	if((listener = _tcp_listen(name, &address)) < 0)
+		return -1;
+	client = transport->plugind->init(&transport->helper, ATM_CLIENT,
+			address);
+	free(address);
+	if(client == NULL)
+	{
+		close(listener);
+		return -1;
+	}
+	if((fd = accept(listener, NULL, NULL)) < 0)
+		ret = -error_set_code(-errno, "%s", strerror(errno));
+	/* it only sends legacy frames until the server sends a versioned one */
+	for(i = 0; ret == 0 && i < 3; i++)
+	{
+		if((message = (i == 0) ? appmessage_new_acknowledgement(0)
+					: appmessage_new_callv("hello", -1))
+				== NULL)
+		{
+			ret = -1;
+			break;
+		}
+		appmessage_set_id(message, i);
+		if((ret = transport->plugind->client_queue(client, message))
+				== 0)
+			ret = _tcp_read_message(transport, fd, &version,
+					&received);
+		appmessage_delete(message);
+		if(ret != 0)
+			break;
+		if(version != ((i < 2) ? 0 : TCP_FRAME_VERSION))
+			ret = -error_set_code(1, "%s%u%s%u", "Frame version ",
+					version, " for message ", i);
+		else if(appmessage_get_id(received) != i)
+			ret = -error_set_code(1, "%s", "Invalid message");
+		appmessage_delete(received);
+		if(ret != 0 || i != 1)
+			continue;
+		/* acknowledge the call with a versioned frame */
+		if((message = appmessage_new_acknowledgement(i)) == NULL)
+			ret = -1;
+		else if((frame = _tcp_frame(message, TCP_FRAME_VERSION, &size))
+				== NULL)
+			ret = -1;
+		else if(write(fd, frame, size) != (ssize_t)size)
+			ret = -error_set_code(-errno, "%s", strerror(errno));
+		else
+			ret = _tcp_wait(transport, 1);
+		free(frame);
+		if(message != NULL)
+			appmessage_delete(message);
+	}
+	transport->plugind->destroy(client);
+	if(fd >= 0)
+		close(fd);
+	close(listener);
+	_tcp_run(transport, 10);
+	return ret;
+}
+
+static int _tcp_negotiate_server(Transport * transport, char const * name)
+{
+	int ret = 0;
+	int fd;
+	AppMessage * message;
+	unsigned char * frame[2] = { NULL, NULL };
+	size_t size[2];
+	unsigned char * frames;
+	unsigned int version;
+
+	if((fd = _tcp_connect(name)) < 0)
+		return -1;
+	/* the announcement and a call, in legacy frames */
+	if((message = appmessage_new_acknowledgement(0)) != NULL)
+	{
+		frame[0] = _tcp_frame(message, 0, &size[0]);
+		appmessage_delete(message);
+	}
+	if((message = appmessage_new_callv("hello", -1)) != NULL)
+	{
+		appmessage_set_id(message, 3);
+		frame[1] = _tcp_frame(message, 0, &size[1]);
+		appmessage_delete(message);
+	}
+	if(frame[0] == NULL || frame[1] == NULL
+			|| (frames = malloc(size[0] + size[1])) == NULL)
+		ret = -1;
+	else
+	{
+		memcpy(frames, frame[0], size[0]);
+		memcpy(&frames[size[0]], frame[1], size[1]);
+		if(write(fd, frames, size[0] + size[1])
+				!= (ssize_t)(size[0] + size[1]))
+			ret = -error_set_code(-errno, "%s", strerror(errno));
+		free(frames);
+	}
+	free(frame[1]);
+	free(frame[0]);
+	/* the server replies with versioned frames */
+	if(ret == 0 && (ret = _tcp_wait(transport, 2)) == 0
+			&& (ret = _tcp_read_message(transport, fd, &version,
+					&message)) == 0)
+	{
+		if(version != TCP_FRAME_VERSION)
+			ret = -error_set_code(1, "%s", "Legacy reply");
+		else if(appmessage_get_type(message) != AMT_ACKNOWLEDGEMENT
+				|| appmessage_get_id(message) != 3)
+			ret = -error_set_code(1, "%s", "Invalid reply");
+		appmessage_delete(message);
+	}
+	close(fd);
+	_tcp_run(transport, 10);
+	return ret;
+}
+
+
+/* tcp_oversized */
+static int _tcp_oversized(Transport * transport, char const * name)
+{
+	int ret = 0;
+	int fd;
+	unsigned char header[TCP_FRAME_LEGACY_SIZE] = { 0x7f, 0xff, 0xff, 0xff };
+	unsigned char c;
+
+	if((fd = _tcp_connect(name)) < 0)
+		return -1;
+	/* the server closes the connection instead of allocating the frame */
+	if(write(fd, header, sizeof(header)) != sizeof(header))
+		ret = -error_set_code(-errno, "%s", strerror(errno));
+	else if(_tcp_read(transport, fd, &c, sizeof(c)) == 0)
+		ret = -error_set_code(1, "%s", "Oversized frame accepted");
+	close(fd);
+	_tcp_run(transport, 10);
+	return ret;
+}
+
+
+/* tcp_partial */
+static int _tcp_partial(Transport * transport, char const * name)
+{
+	int ret;
+	int fd;
+	Buffer * buffer;
+	Variable * variable;
+	AppMessage * message;
+	AppMessage * received = NULL;
+	unsigned int version;
+	Buffer * b[2];
+
+	/* larger than the socket buffers */
+	if((buffer = buffer_new(4 * 1024 * 1024 + 3, NULL)) == NULL)
+		return -1;
+	memset(buffer_get_data(buffer), 'x', buffer_get_size(buffer));
+	variable = variable_new(VT_BUFFER, buffer);
+	buffer_delete(buffer);
+	if(variable == NULL)
+		return -1;
+	message = appmessage_new_callv_variables("big", variable, NULL);
+	variable_delete(variable);
+	if(message == NULL)
+		return -1;
+	if((fd = _tcp_connect(name)) < 0)
+	{
+		appmessage_delete(message);
+		return -1;
+	}
+	/* the server only sends what the socket accepts at a time */
+	_tcp_run(transport, 10);
+	if(transport->client == NULL)
+		ret = -error_set_code(1, "%s", "Client not accepted");
+	else if((ret = transport->plugind->server_send(transport->server,
+					transport->client, message)) == 0)
+		ret = _tcp_read_message(transport, fd, &version, &received);
+	close(fd);
+	_tcp_run(transport, 10);
+	/* compare the messages */
+	b[0] = buffer_new(0, NULL);
+	b[1] = buffer_new(0, NULL);
+	if(ret == 0 && (b[0] == NULL || b[1] == NULL
+				|| appmessage_serialize(message, b[0]) != 0
+				|| appmessage_serialize(received, b[1]) != 0))
+		ret = -1;
+	else if(ret == 0 && (buffer_get_size(b[0]) != buffer_get_size(b[1])
+				|| memcmp(buffer_get_data(b[0]),
+					buffer_get_data(b[1]),
+					buffer_get_size(b[0])) != 0))
+		ret = -error_set_code(1, "%s", "Message corrupted");
+	if(b[1] != NULL)
+		buffer_delete(b[1]);
+	if(b[0] != NULL)
+		buffer_delete(b[0]);
+	if(received != NULL)
+		appmessage_delete(received);
+	appmessage_delete(message);
+	return ret;
+}
+
+
+/* tcp_split */
+static int _tcp_split(Transport * transport, char const * name)
+{
+	int ret = 0;
+	int fd;
+	AppMessage * message;
+	unsigned char * frame;
+	size_t size;
+	size_t cuts[] = { 3, TCP_FRAME_HEADER_SIZE + 1, 0 };
+	size_t i;
+	size_t pos;
+	unsigned int version;
+
+	if((fd = _tcp_connect(name)) < 0)
+		return -1;
+	if((message = appmessage_new_callv("hello", -1)) == NULL)
+	{
+		close(fd);
+		return -1;
+	}
+	appmessage_set_id(message, 2);
+	frame = _tcp_frame(message, TCP_FRAME_VERSION, &size);
+	appmessage_delete(message);
+	if(frame == NULL)
+	{
+		close(fd);
+		return -1;
+	}
+	/* the frame is cut within the header and then the payload */
+	cuts[sizeof(cuts) / sizeof(*cuts) - 1] = size;
+	for(i = 0, pos = 0; ret == 0 && i < sizeof(cuts) / sizeof(*cuts);
+			pos = cuts[i++])
+		if(write(fd, &frame[pos], cuts[i] - pos)
+				!= (ssize_t)(cuts[i] - pos))
+			ret = -error_set_code(-errno, "%s", strerror(errno));
+		else
+			_tcp_run(transport, 10);
+	free(frame);
+	/* the reply is versioned as well */
+	if(ret == 0 && (ret = _tcp_wait(transport, 1)) == 0
+			&& (ret = _tcp_read_message(transport, fd, &version,
+					&message)) == 0)
+	{
+		if(version != TCP_FRAME_VERSION)
+			ret = -error_set_code(1, "%s", "Legacy reply");
+		else if(appmessage_get_type(message) != AMT_ACKNOWLEDGEMENT
+				|| appmessage_get_id(message) != 2)
+			ret = -error_set_code(1, "%s", "Invalid reply");
+		appmessage_delete(message);
+	}
+	close(fd);
+	_tcp_run(transport, 10);
+	return ret;
+}
+
+
+/* useful */
+/* tcp_connect */
+static int _tcp_connect(char const * name)
+{
+	int fd = -1;
+	char * hostname;
+	char * servname;
+	struct addrinfo hints;
+	struct addrinfo * ai;
+	struct addrinfo * aip;
+	int res;
+
+	if((hostname = strdup(name)) == NULL)
+		return -error_set_code(-errno, "%s", strerror(errno));
+	if((servname = strrchr(hostname, ':')) == NULL)
+	{
+		free(hostname);
+		return -error_set_code(1, "%s: %s", name, "Invalid address");
+	}
+	*(servname++) = '\0';
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	if((res = getaddrinfo(hostname, servname, &hints, &ai)) != 0)
+	{
+		free(hostname);
+		return -error_set_code(1, "%s: %s", name, gai_strerror(res));
+	}
+	free(hostname);
+	for(aip = ai; aip != NULL; aip = aip->ai_next)
+	{
+		if((fd = socket(aip->ai_family, aip->ai_socktype,
+						aip->ai_protocol)) < 0)
+			continue;
+		if(connect(fd, aip->ai_addr, aip->ai_addrlen) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(ai);
+	if(fd < 0)
+		return -error_set_code(1, "%s: %s", name, strerror(errno));
+	return fd;
+}
+
+
+/* tcp_listen */
+static int _tcp_listen(char const * name, char ** address)
+{
+	int fd = -1;
+	char * hostname;
+	char * p;
+	struct addrinfo hints;
+	struct addrinfo * ai;
+	int res;
+	struct sockaddr_storage ss;
+	socklen_t ss_len = sizeof(ss);
+	char servname[NI_MAXSERV];
+
+	if((hostname = strdup(name)) == NULL)
+		return -error_set_code(-errno, "%s", strerror(errno));
+	if((p = strrchr(hostname, ':')) == NULL)
+	{
+		free(hostname);
+		return -error_set_code(1, "%s: %s", name, "Invalid address");
+	}
+	*p = '\0';
+	/* on any port available */
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	if((res = getaddrinfo(hostname, "0", &hints, &ai)) != 0)
+	{
+		free(hostname);
+		return -error_set_code(1, "%s: %s", name, gai_strerror(res));
+	}
+	if((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0
+			|| bind(fd, ai->ai_addr, ai->ai_addrlen) != 0
+			|| listen(fd, 1) != 0
+			|| getsockname(fd, (struct sockaddr *)&ss, &ss_len) != 0
+			|| (res = getnameinfo((struct sockaddr *)&ss, ss_len,
+					NULL, 0, servname, sizeof(servname),
+					NI_NUMERICSERV)) != 0
+			|| (*address = malloc(strlen(hostname)
+					+ strlen(servname) + 2)) == NULL)
+	{
+		error_set_code(-errno, "%s: %s", name, strerror(errno));
+		if(fd >= 0)
+			close(fd);
+		fd = -1;
+	}
+	else
+		sprintf(*address, "%s:%s", hostname, servname);
+	freeaddrinfo(ai);
+	free(hostname);
+	return fd;
+}
+
+
+/* tcp_frame */
+static unsigned char * _tcp_frame(AppMessage * message, unsigned int version,
+		size_t * size)
+{
+	unsigned char * ret;
+	Buffer * buffer;
+	unsigned char * p;
+	size_t len;
+
+	if((buffer = buffer_new(0, NULL)) == NULL)
+		return NULL;
+	if(appmessage_serialize(message, buffer) != 0)
+	{
+		buffer_delete(buffer);
+		return NULL;
+	}
+	len = buffer_get_size(buffer);
+	*size = ((version != 0) ? TCP_FRAME_HEADER_SIZE
+			: TCP_FRAME_LEGACY_SIZE) + len;
+	if((ret = malloc(*size)) == NULL)
+	{
+		buffer_delete(buffer);
+		error_set_code(-errno, "%s", strerror(errno));
+		return NULL;
+	}
+	p = ret;
+	if(version != 0)
+	{
+		*(p++) = TCP_FRAME_MARKER | version;
+		*(p++) = 0;
+		*(p++) = 0;
+		*(p++) = 0;
+	}
+	*(p++) = (len >> 24) & 0xff;
+	*(p++) = (len >> 16) & 0xff;
+	*(p++) = (len >> 8) & 0xff;
+	*(p++) = len & 0xff;
+	memcpy(p, buffer_get_data(buffer), len);
+	buffer_delete(buffer);
+	return ret;
+}
+
+
+/* tcp_read */
+static int _tcp_read(Transport * transport, int fd, unsigned char * buf,
+		size_t size)
+{
+	size_t i;
+	ssize_t ssize;
+
+	/* let the server send while reading */
+	for(i = 0; size > 0 && i < 1000; i++)
+	{
+		_tcp_run(transport, 1);
+		if((ssize = recv(fd, buf, size, MSG_DONTWAIT)) == 0)
+			return -error_set_code(1, "%s", "Connection closed");
+		else if(ssize < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+			return -error_set_code(-errno, "%s", strerror(errno));
+		else if(ssize > 0)
+		{
+			buf += ssize;
+			size -= ssize;
+		}
+	}
+	return (size == 0) ? 0 : -error_set_code(1, "%s", "Timeout");
+}
+
+
+/* tcp_read_message */
+static int _tcp_read_message(Transport * transport, int fd,
+		unsigned int * version, AppMessage ** message)
+{
+	unsigned char header[TCP_FRAME_HEADER_SIZE];
+	unsigned char * p = header;
+	uint32_t len;
+	Buffer * buffer;
+
+	if(_tcp_read(transport, fd, header, TCP_FRAME_LEGACY_SIZE) != 0)
+		return -1;
+	if(header[0] & TCP_FRAME_MARKER)
+	{
+		*version = header[0] & ~TCP_FRAME_MARKER;
+		if(_tcp_read(transport, fd, &header[TCP_FRAME_LEGACY_SIZE],
+					TCP_FRAME_HEADER_SIZE
+					- TCP_FRAME_LEGACY_SIZE) != 0)
+			return -1;
+		p += TCP_FRAME_HEADER_SIZE - TCP_FRAME_LEGACY_SIZE;
+	}
+	else
+		*version = 0;
+	len = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+		| ((uint32_t)p[2] << 8) | p[3];
+	if((buffer = buffer_new(len, NULL)) == NULL)
+		return -1;
+	if(_tcp_read(transport, fd, (unsigned char *)buffer_get_data(buffer),
+				len) != 0
+			|| (*message = appmessage_new_deserialize(buffer))
+			== NULL)
+	{
+		buffer_delete(buffer);
+		return -1;
+	}
+	buffer_delete(buffer);
+	return 0;
+}
+
+
+/* tcp_run */
+static void _tcp_run(Transport * transport, unsigned int ms)
+{
+	struct timeval tv;
+
+	tv.tv_sec = ms / 1000;
+	tv.tv_usec = (ms % 1000) * 1000;
+	if(event_register_timeout(transport->helper.event, &tv,
+				_tcp_callback_timeout, transport) == 0)
+		event_loop(transport->helper.event);
+}
+
+
+/* tcp_wait */
+static int _tcp_wait(Transport * transport, unsigned int received)
+{
+	size_t i;
+
+	for(i = 0; transport->received < received && i < 1000; i++)
+		_tcp_run(transport, 1);
+	if(transport->received != received)
+		return -error_set_code(1, "%u/%u%s", transport->received,
+				received, " messages received");
+	transport->received = 0;
+	return 0;
+}
+
+
+/* helpers */
+/* tcp_helper_receive */
+static int _tcp_helper_receive(AppTransport * transport, AppMessage * message)
+{
+	transport->received++;
+	return 0;
+}
+
+
+/* tcp_helper_client_new */
+static AppTransportClient * _tcp_helper_client_new(AppTransport * transport,
+		char const * name)
+{
+	AppTransportClient * client;
+
+	if((client = object_new(sizeof(*client))) == NULL)
+		return NULL;
+	client->data = NULL;
+	transport->client = client;
+	return client;
+}
+
+
+/* tcp_helper_client_delete */
+static void _tcp_helper_client_delete(AppTransport * transport,
+		AppTransportClient * client)
+{
+	if(transport->client == client)
+		transport->client = NULL;
+	object_delete(client);
+}
+
+
+/* tcp_helper_client_receive */
+static int _tcp_helper_client_receive(AppTransport * transport,
+		AppTransportClient * client, AppMessage * message)
+{
+	AppMessageID id;
+	AppMessage * reply;
+
+	transport->received++;
+	/* acknowledge the message if requested */
+	if((id = appmessage_get_id(message)) == 0)
+		return 0;
+	if((reply = appmessage_new_acknowledgement(id)) == NULL)
+		return -1;
+	transport->plugind->server_send(transport->server, client, reply);
+	appmessage_delete(reply);
+	return 0;
+}
+
+
+/* tcp_helper_client_get_data */
+static void * _tcp_helper_client_get_data(AppTransport * transport,
+		AppTransportClient * client)
+{
+	return client->data;
+}
+
+
+/* tcp_helper_client_set_data */
+static void _tcp_helper_client_set_data(AppTransport * transport,
+		AppTransportClient * client, void * data)
+{
+	client->data = data;
+}
+
+
+/* tcp_helper_lookup */
+static int _tcp_helper_lookup(AppTransport * transport, char const * hostname,
+		char const * servname, struct addrinfo const * hints,
+		struct addrinfo ** res)
+{
+	return getaddrinfo(hostname, servname, hints, res);
+}
+
+
+/* tcp_helper_lookup_free */
+static void _tcp_helper_lookup_free(AppTransport * transport,
+		struct addrinfo * ai)
+{
+	freeaddrinfo(ai);
+}
+
+
+/* callbacks */
+/* tcp_callback_timeout */
+static int _tcp_callback_timeout(void * data)
+{
+	Transport * transport = data;
+
+	event_loop_quit(transport->helper.event);
+	return 1;
+}
+
+
+/* usage */
+static int _usage(void)
+{
+	fputs("Usage: " PROGNAME " [-p protocol] [name]\n", stderr);
+	return 1;
+}
+
+
+/* public */
+/* functions */
+/* main */
+int main(int argc, char * argv[])
+{
+	char const * protocol = "tcp4";
+	char const * name = "127.0.0.1:4242";
+	int o;
+
+	while((o = getopt(argc, argv, "p:")) != -1)
+		switch(o)
+		{
+			case 'p':
+				protocol = optarg;
+				break;
+			default:
+				return _usage();
+		}
+	if(optind == argc - 1)
+		name = argv[optind];
+	else if(optind != argc)
+		return _usage();
+	return (_tcp(protocol, name) == 0) ? 0 : 2;
+}
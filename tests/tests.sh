@@ -153,6 +153,21 @@ while [ $# -ne 0 ]; do
 	APPINTERFACE_Dummy=../data/Dummy.interface \
 		APPSERVER_Dummy="tcp:localhost:4242" \
 		_test "appserver" "appserver" -a "Dummy"
+	APPINTERFACE_Dummy=../data/Dummy.interface \
+		_test "appserver" "appserver threads" -a "Dummy" \
+		-n tcp:localhost:4242 -t 2 -w 2
+	APPINTERFACE_Dummy=../data/Dummy.interface \
+		_test "appserver" "appserver threads ordered" -a "Dummy" \
+		-n tcp:localhost:4242 -o -t 2 -w 2
+	APPINTERFACE_Calls=Calls.interface \
+		_test "appserver" "appserver calls" -a "Calls" \
+		-n tcp:localhost:4242 -c 10
+	APPINTERFACE_Calls=Calls.interface \
+		_test "appserver" "appserver threads calls" -a "Calls" \
+		-n tcp:localhost:4242 -c 10 -t 2
+	APPINTERFACE_Calls=Calls.interface \
+		_test "appserver" "appserver threads ordered calls" -a "Calls" \
+		-n tcp:localhost:4242 -c 10 -o -t 2
 	_test "includes" "includes"
 	APPINTERFACE_Test=Test.interface \
 		_test "lookup" "lookup Test tcp" -a "Test" \
@@ -162,6 +177,7 @@ while [ $# -ne 0 ]; do
 		-n "tcp4:localhost:4242"
 	APPSERVER_Session="tcp:localhost:4242" _test "lookup" \
 		"lookup Session" -a "Session"
+	_test "tcp" "tcp4 127.0.0.1:4242" -p tcp4 127.0.0.1:4242
 	_test "transport" "tcp4 127.0.0.1:4242" -p tcp4 127.0.0.1:4242
 	_test "transport" "tcp4 localhost:4242" -p tcp4 localhost:4242
 	_test "transport" "tcp6 ::1.4242" -p tcp6 ::1.4242
@@ -20,6 +20,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <netdb.h>
 #include <System.h>
 #include "App.h"
 
@@ -38,6 +39,7 @@ typedef struct _AppTransport
 	AppTransportPlugin * server;
 	AppTransportPlugin * client;
 	AppMessage * message;
+	void * data;
 } Transport;
 
 
@@ -57,6 +59,16 @@ static void _transport_helper_client_delete(AppTransport * transport,
 		AppTransportClient * client);
 static int _transport_helper_client_receive(AppTransport * transport,
 		AppTransportClient * client, AppMessage * message);
+static void * _transport_helper_client_get_data(AppTransport * transport,
+		AppTransportClient * client);
+static void _transport_helper_client_set_data(AppTransport * transport,
+		AppTransportClient * client, void * data);
+
+static int _transport_helper_lookup(AppTransport * transport,
+		char const * hostname, char const * servname,
+		struct addrinfo const * hints, struct addrinfo ** res);
+static void _transport_helper_lookup_free(AppTransport * transport,
+		struct addrinfo * ai);
 
 /* callbacks */
 static int _transport_callback_idle(void * data);
@@ -88,6 +100,7 @@ static int _transport(char const * protocol, char const * name)
 	if(plugin == NULL)
 		return error_print(PROGNAME);
 	transport.ret = 0;
+	transport.data = NULL;
 	if((transport.plugind = plugin_lookup(plugin, "transport")) == NULL)
 	{
 		plugin_delete(plugin);
@@ -102,6 +115,10 @@ static int _transport(char const * protocol, char const * name)
 	helper->client_new = _transport_helper_client_new;
 	helper->client_delete = _transport_helper_client_delete;
 	helper->client_receive = _transport_helper_client_receive;
+	helper->client_get_data = _transport_helper_client_get_data;
+	helper->client_set_data = _transport_helper_client_set_data;
+	helper->lookup = _transport_helper_lookup;
+	helper->lookup_free = _transport_helper_lookup_free;
 	/* create a server and a client */
 	transport.server = (helper->event != NULL)
 		? transport.plugind->init(helper, ATM_SERVER, name) : NULL;
@@ -183,6 +200,39 @@ static int _transport_helper_client_receive(AppTransport * transport,
 }
 
 
+/* transport_helper_client_get_data */
+static void * _transport_helper_client_get_data(AppTransport * transport,
+		AppTransportClient * client)
+{
+	return transport->data;
+}
+
+
+/* transport_helper_client_set_data */
+static void _transport_helper_client_set_data(AppTransport * transport,
+		AppTransportClient * client, void * data)
+{
+	transport->data = data;
+}
+
+
+/* transport_helper_lookup */
+static int _transport_helper_lookup(AppTransport * transport,
+		char const * hostname, char const * servname,
+		struct addrinfo const * hints, struct addrinfo ** res)
+{
+	return getaddrinfo(hostname, servname, hints, res);
+}
+
+
+/* transport_helper_lookup_free */
+static void _transport_helper_lookup_free(AppTransport * transport,
+		struct addrinfo * ai)
+{
+	freeaddrinfo(ai);
+}
+
+
 /* transport_helper_receive */
 static int _transport_helper_receive(AppTransport * transport,
 		AppMessage * message)
@@ -62,6 +62,8 @@ static int _appbroker_do(AppBroker * appbroker, AppTransportMode mode);
 static int _appbroker_foreach_call(char const * key, Hash * value, void * data);
 static int _appbroker_foreach_call_arg(AppBroker * appbroker, char const * sep,
 		char const * arg);
+static int _appbroker_foreach_call_oneway(AppBroker * appbroker,
+		char const * key, Hash * value);
 static int _appbroker_foreach_callback(char const * key, Hash * value,
 		void * data);
 static int _appbroker_foreach_constant(char const * key, char const * value,
@@ -290,6 +292,9 @@ static int _appbroker_foreach_call(char const * key, Hash * value, void * data)
 	if((p = _appbroker_ctype(p)) == NULL)
 		appbroker->error = -error_set_print(PROGNAME_APPBROKER, 1,
 				"%s: %s", key, "Invalid return type for call");
+	if(_appbroker_foreach_call_oneway(appbroker, key, value) == 1
+			&& appbroker->fp != NULL)
+		fputs("/* one-way */\n", appbroker->fp);
 	if(appbroker->fp != NULL)
 		fprintf(appbroker->fp, "%s%s%s%s%s%s", p, " ",
 				appbroker->prefix, "_", key,
@@ -333,6 +338,49 @@ static int _appbroker_foreach_call_arg(AppBroker * appbroker, char const * sep,
 	return 0;
 }
 
+static int _appbroker_foreach_call_oneway(AppBroker * appbroker,
+		char const * key, Hash * value)
+{
+	unsigned int i;
+	char buf[8];
+	char const * p;
+	char const * q;
+
+	if((p = hash_get(value, "oneway")) == NULL || strcmp(p, "0") == 0)
+		return 0;
+	if(strcmp(p, "1") != 0)
+	{
+		appbroker->error = -error_set_print(PROGNAME_APPBROKER, 1,
+				"%s: %s", key, "Invalid value for oneway");
+		return -1;
+	}
+	/* one-way calls are not replied to */
+	if((p = hash_get(value, "ret")) != NULL && strcmp(p, "VOID") != 0)
+	{
+		appbroker->error = -error_set_print(PROGNAME_APPBROKER, 1,
+				"%s: %s", key,
+				"One-way calls cannot return values");
+		return -1;
+	}
+	for(i = 0; i < APPSERVER_MAX_ARGUMENTS; i++)
+	{
+		snprintf(buf, sizeof(buf), "arg%u", i + 1);
+		if((p = hash_get(value, buf)) == NULL)
+			break;
+		/* the direction is a suffix of the type */
+		if((q = strchr(p, '_')) != NULL && (q = strstr(q, "OUT"))
+				!= NULL && (q[3] == '\0' || q[3] == ','
+					|| q[3] == '['))
+		{
+			appbroker->error = -error_set_print(PROGNAME_APPBROKER,
+					1, "%s: %s", key, "One-way calls"
+					" cannot return values");
+			return -1;
+		}
+	}
+	return 1;
+}
+
 static int _appbroker_foreach_callback(char const * key, Hash * value,
 		void * data)
 {